@@ -0,0 +1,287 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: batchreader.cpp
+ */
+
+#include "batchreader.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Offset of ring field given by kernel
+#define RING_FIELD(ring, offset) ((unsigned int *)((char *)(ring) + (offset)))
+
+BatchReader::BatchReader(unsigned int depth)
+  : slots(depth), ring_fd(-1), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sqes(MAP_FAILED)
+{
+  for (unsigned int i = depth; i > 0; i--) {
+    free_slots.push_back(i - 1);
+  }
+
+#ifdef __NR_io_uring_setup
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+
+  if (ring_fd < 0) {
+    ring_fd = -1;
+    return;
+  }
+
+  // Map submission and completion rings and submission entries
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  sq_ring = mmap(0, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 ring_fd, IORING_OFF_SQ_RING);
+  cq_ring = mmap(0, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 ring_fd, IORING_OFF_CQ_RING);
+  sqes = mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              ring_fd, IORING_OFF_SQES);
+
+  if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+    closeRing();
+    return;
+  }
+
+  sq_head  = RING_FIELD(sq_ring, params.sq_off.head);
+  sq_tail  = RING_FIELD(sq_ring, params.sq_off.tail);
+  sq_mask  = RING_FIELD(sq_ring, params.sq_off.ring_mask);
+  sq_array = RING_FIELD(sq_ring, params.sq_off.array);
+
+  cq_head = RING_FIELD(cq_ring, params.cq_off.head);
+  cq_tail = RING_FIELD(cq_ring, params.cq_off.tail);
+  cq_mask = RING_FIELD(cq_ring, params.cq_off.ring_mask);
+  cqes = (char *)cq_ring + params.cq_off.cqes;
+#endif
+}
+
+BatchReader::~BatchReader()
+{
+  // Finish all reads, kernel may still write into slot buffers
+  while (pending() > 0) {
+    complete([](unsigned int, std::vector<unsigned char> &) {});
+  }
+
+  closeRing();
+}
+
+bool BatchReader::queue(unsigned int id, std::string path)
+{
+  if (full()) {
+    return false;
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat info;
+
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  const unsigned int index = free_slots.back();
+  free_slots.pop_back();
+
+  slot_t &slot = slots.at(index);
+  slot.id = id;
+  slot.fd = fd;
+  slot.offset = 0;
+  slot.data.resize(info.st_size);
+
+  prepare(index);
+  return true;
+}
+
+void BatchReader::complete(const done_t &done)
+{
+  if (ring_fd < 0) {
+    readQueued(done);
+    return;
+  }
+
+#ifdef __NR_io_uring_enter
+  if (pending() == 0) {
+    return;
+  }
+
+  // Submit all queued reads and wait for at least one completion
+  while (true) {
+    int submitted = syscall(__NR_io_uring_enter, ring_fd, queued.size(), 1,
+                            IORING_ENTER_GETEVENTS, 0, 0);
+
+    if (submitted >= 0) {
+      queued.erase(queued.begin(), queued.begin() + submitted);
+
+      if (queued.empty()) {
+        break;
+      }
+      continue;
+    }
+
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+      continue;
+    }
+
+    // Ring cannot be used anymore, all reads which did not finish
+    // (queued or in flight) continue by pread from their offset
+    std::vector<char> busy(slots.size(), true);
+
+    for (unsigned int i = 0; i < free_slots.size(); i++) {
+      busy.at(free_slots.at(i)) = false;
+    }
+
+    closeRing();
+    queued.clear();
+
+    for (unsigned int i = 0; i < slots.size(); i++) {
+      if (busy.at(i)) {
+        queued.push_back(i);
+      }
+    }
+
+    readQueued(done);
+    return;
+  }
+
+  // Reap completions, short reads are queued again
+  unsigned int head = *cq_head;
+  std::vector<unsigned int> finished;
+
+  while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    const struct io_uring_cqe *cqe = (const struct io_uring_cqe *)cqes + (head & *cq_mask);
+    const unsigned int index = cqe->user_data;
+    const int result = cqe->res;
+    head++;
+
+    slot_t &slot = slots.at(index);
+
+    if (result == -EINTR || result == -EAGAIN) {
+      prepare(index);
+      continue;
+    }
+
+    if (result <= 0) {
+      slot.data.clear();
+      finished.push_back(index);
+      continue;
+    }
+
+    slot.offset += result;
+
+    if (slot.offset < slot.data.size()) {
+      prepare(index);
+    } else {
+      finished.push_back(index);
+    }
+  }
+
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+  for (unsigned int i = 0; i < finished.size(); i++) {
+    finish(finished.at(i), !slots.at(finished.at(i)).data.empty(), done);
+  }
+#endif
+}
+
+void BatchReader::closeRing()
+{
+  if (sqes != MAP_FAILED)    { munmap(sqes, sqes_size); }
+  if (cq_ring != MAP_FAILED) { munmap(cq_ring, cq_ring_size); }
+  if (sq_ring != MAP_FAILED) { munmap(sq_ring, sq_ring_size); }
+
+  if (ring_fd >= 0) {
+    ::close(ring_fd);
+  }
+
+  ring_fd = -1;
+  sq_ring = cq_ring = sqes = MAP_FAILED;
+}
+
+void BatchReader::prepare(unsigned int index)
+{
+  slot_t &slot = slots.at(index);
+  queued.push_back(index);
+
+  if (ring_fd < 0) {
+    return;
+  }
+
+  slot.vector.iov_base = &slot.data[0] + slot.offset;
+  slot.vector.iov_len = slot.data.size() - slot.offset;
+
+  // Each slot has at most one entry in flight, so the ring never overflows
+  const unsigned int tail = *sq_tail;
+  const unsigned int position = tail & *sq_mask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)sqes + position;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = slot.fd;
+  sqe->off = slot.offset;
+  sqe->addr = (unsigned long)&slot.vector;
+  sqe->len = 1;
+  sqe->user_data = index;
+
+  sq_array[position] = position;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void BatchReader::readQueued(const done_t &done)
+{
+  std::vector<unsigned int> reads;
+  reads.swap(queued);
+
+  for (unsigned int i = 0; i < reads.size(); i++) {
+    slot_t &slot = slots.at(reads.at(i));
+
+    while (slot.offset < slot.data.size()) {
+      ssize_t result = pread(slot.fd, &slot.data[0] + slot.offset,
+                             slot.data.size() - slot.offset, slot.offset);
+
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (result <= 0) {
+        break;
+      }
+      slot.offset += result;
+    }
+
+    finish(reads.at(i), slot.offset == slot.data.size(), done);
+  }
+}
+
+void BatchReader::finish(unsigned int index, bool ok, const done_t &done)
+{
+  slot_t &slot = slots.at(index);
+  ::close(slot.fd);
+
+  if (!ok) {
+    slot.data.clear();
+  }
+
+  free_slots.push_back(index);
+  done(slot.id, slot.data);
+
+  std::vector<unsigned char>().swap(slot.data);
+}
@@ -0,0 +1,108 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: batchreader.h
+ */
+
+#ifndef BATCHREADER_H
+#define BATCHREADER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <sys/uio.h>
+
+// Maximum number of reads in flight
+#define BATCH_READER_DEPTH 64
+
+// Reader of whole files keeping many reads in flight on io_uring
+// (Linux 5.1+). Queued reads are submitted and completed with one system
+// call, completed files are handed over in order of completion. If
+// io_uring is not available or fails, files are read sequentially by
+// pread(). The reader is used by a single thread.
+//
+class BatchReader
+{
+public:
+  // Completed file, data are empty if the file could not be read
+  typedef std::function<void(unsigned int id, std::vector<unsigned char> &data)> done_t;
+
+  BatchReader(unsigned int depth = BATCH_READER_DEPTH);
+  ~BatchReader();
+
+  // Check whether io_uring is used
+  bool ready() const { return ring_fd >= 0; }
+
+  // Check whether another read can be queued
+  bool full() const { return free_slots.empty(); }
+
+  // Number of queued or running reads
+  unsigned int pending() const { return slots.size() - free_slots.size(); }
+
+  // Open file and queue read of its content, returns false
+  // if the file could not be opened (nothing is queued)
+  bool queue(unsigned int id, std::string path);
+
+  // Submit queued reads, wait for at least one read to complete
+  // and pass all completed files to done
+  void complete(const done_t &done);
+
+protected:
+  // Read state of one file
+  typedef struct slot {
+
+    unsigned int id;
+    int fd;
+    std::size_t offset;
+    std::vector<unsigned char> data;
+    struct iovec vector;
+
+  } slot_t;
+
+  // Put read of remaining data of slot into submission queue
+  void prepare(unsigned int index);
+
+  // Read slots queued since last complete() without io_uring
+  void readQueued(const done_t &done);
+
+  // Pass slot data to done and release the slot
+  void finish(unsigned int index, bool ok, const done_t &done);
+
+  // Unmap rings and close io_uring (reads continue by pread)
+  void closeRing();
+
+private:
+  BatchReader(const BatchReader &);
+  BatchReader & operator=(const BatchReader &);
+
+  std::vector<slot_t> slots;
+  std::vector<unsigned int> free_slots;
+  std::vector<unsigned int> queued;
+
+  // io_uring file descriptor and shared rings
+  int ring_fd;
+
+  void *sq_ring;
+  void *cq_ring;
+  void *sqes;
+
+  std::size_t sq_ring_size;
+  std::size_t cq_ring_size;
+  std::size_t sqes_size;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  void *cqes;
+};
+
+#endif // BATCHREADER_H
@@ -8,36 +8,88 @@
  *  file: bayesclassifier.cpp
  */
 
+#include <algorithm>
+#include <cstring>
+
 #include "bayesclassifier.h"
 
-BayesClassifier::BayesClassifier(int quantization, int method_space, bool subsampling)
+BayesClassifier::BayesClassifier(int quantization, int method_space, bool subsampling, int layout_order)
 {
-  method = method_space;
-  quant = quantization;
+  setParameters(quantization, method_space, subsampling, layout_order);
 
-  if (method == BAYESIAN_RGB) {
-    positive3D = vector3D(256 / quant, 0);
-    negative3D = vector3D(256 / quant, 0);
-  } else {
-    positive1D = vector1D(256 / quant, 0);;
-    negative1D = vector1D(256 / quant, 0);;
-  }
+  number_of_samples = 0;
 
   positive_samples = 0;
   negative_samples = 0;
 
-  subsample = (subsampling) ? 2 : 1;
+  resetCounts();
+
+  threads = 0;
+
+  shard_index = 0;
+  shard_count = 1;
+
+  mapped_positive = 0;
+  mapped_negative = 0;
+  mapped_posterior = 0;
+  mapped_index = 0;
+
+  precision = POSTERIOR_DOUBLE;
+  table_format = POSTERIOR_DOUBLE;
+  stale.value = false;
+
+  refresh_lock = std::make_shared<std::mutex>();
 }
 
 
+void BayesClassifier::setParameters(int quantization, int method_space, bool subsampling, int layout_order)
+{
+  method = method_space;
+  quant = quantization;
+
+  // Bins of one component have only one order
+  layout = (method == BAYESIAN_RGB) ? layout_order : LAYOUT_LINEAR;
+
+  subsample = (subsampling) ? 2 : 1;
+
+  shift = 0;
+  while (shift < 8 && (1 << shift) < quant) {
+    shift++;
+  }
+
+  // Bin kernel of this method and quantization
+  bin_kernel = binKernel(shift, (method == BAYESIAN_RGB) ? 3 : 1, layout == LAYOUT_MORTON);
+
+  // Dense tables of fine quantization would be mostly empty
+  sparse = (method == BAYESIAN_RGB && getHistogramSize() * sizeof(double) > SPARSE_TABLE_MEMORY);
+}
+
 bool BayesClassifier::train(std::string positive, std::string negative)
+{
+  if (!update(positive, negative)) {
+    return false;
+  }
+
+  computeModel();
+  return true;
+}
+
+bool BayesClassifier::train(const std::vector<ImageView> &positive, const std::vector<ImageView> &negative)
+{
+  if (!update(positive, negative)) {
+    return false;
+  }
+
+  computeModel();
+  return true;
+}
+
+bool BayesClassifier::update(std::string positive, std::string negative)
 {
   std::string image_path;
   std::ifstream input_positive(positive.c_str());
   std::ifstream input_negative(negative.c_str());
 
-  number_of_samples = 0;
-
   if (!input_positive.is_open() || !input_negative.is_open()) {
     return false;
   }
@@ -47,125 +99,372 @@ bool BayesClassifier::train(std::string positive, std::string negative)
     return false;
   }
 
-  // Load positive images and update model
-  while (std::getline(input_positive, image_path)) {
-    bitmap_image image(image_path.c_str());
+  std::vector<std::string> paths;
+  std::vector<char> labels;
 
-    if (!image) {
-      std::cerr << "Image " << image_path << " not found" << std::endl;
-    } else {
-      addSample(image, true);
-      number_of_samples++;
+  // Read paths of positive and negative images (of this shard)
+  for (unsigned int line = 0; std::getline(input_positive, image_path); line++) {
+    if (line % shard_count == shard_index) {
+      paths.push_back(image_path);
+      labels.push_back(true);
+    }
+  }
+
+  for (unsigned int line = 0; std::getline(input_negative, image_path); line++) {
+    if (line % shard_count == shard_index) {
+      paths.push_back(image_path);
+      labels.push_back(false);
     }
   }
 
-  // Load negative images and update model
-  while (std::getline(input_negative, image_path)) {
-    bitmap_image image(image_path.c_str());
+  // Load images ahead of histogram workers and update model
+  ImageLoader loader(paths);
+  std::vector<char> added;
 
-    if (!image) {
-      std::cerr << "Image " << image_path << " not found." << std::endl;
+  addSamples(paths.size(), [&](unsigned int i, BayesClassifier &model) {
+    std::shared_ptr<MappedBitmap> image = loader.get(i);
+
+    if (!*image) {
+      return false;
+    }
+
+    model.addSample(image->view(), labels.at(i));
+    return true;
+  }, added);
+
+  for (unsigned int i = 0; i < paths.size(); i++) {
+    if (!added.at(i)) {
+      std::cerr << "Image " << paths.at(i) << " not found" << (labels.at(i) ? "" : ".") << std::endl;
     } else {
-      addSample(image, false);
       number_of_samples++;
     }
   }
 
-  // Compute prior probability
-  prior = (double) positive_samples / (positive_samples + negative_samples);
-
-  positive1D.normalize();
-  negative1D.normalize();
-  positive3D.normalize();
-  negative3D.normalize();
-
+  stale.value = true;
   return true;
 }
 
-bool BayesClassifier::train(std::vector<bitmap_image> positive, std::vector<bitmap_image> negative)
+bool BayesClassifier::update(const std::vector<ImageView> &positive, const std::vector<ImageView> &negative)
 {
   if (quant <= 0 || (quant & (quant - 1)) != 0) {
     std::cerr << "Quantization value must be power of 2" << std::endl;
     return false;
   }
 
-  // Get positive samples and update model
-  for (unsigned int i = 0; i < positive.size(); i++) {
-    addSample(positive.at(i), true);
+  // Get positive and negative samples and update model
+  std::vector<char> added;
+
+  addSamples(positive.size() + negative.size(), [&](unsigned int i, BayesClassifier &model) {
+    if (i < positive.size()) {
+      model.addSample(positive.at(i), true);
+    } else {
+      model.addSample(negative.at(i - positive.size()), false);
+    }
+    return true;
+  }, added);
+
+  number_of_samples += positive.size() + negative.size();
+
+  stale.value = true;
+  return true;
+}
+
+void BayesClassifier::refresh()
+{
+  if (stale.value) {
+    computeModel();
   }
+}
 
-  // Get negative samples and update model
-  for (unsigned int i = 0; i < negative.size(); i++) {
-    addSample(negative.at(i), false);
+bool BayesClassifier::setShard(unsigned int index, unsigned int count)
+{
+  if (count == 0 || index >= count) {
+    return false;
   }
 
-  // Compute prior probability
-  prior = (double) positive_samples / (positive_samples + negative_samples);
+  shard_index = index;
+  shard_count = count;
+  return true;
+}
 
-  number_of_samples = positive.size() + negative.size();
+void BayesClassifier::setThreads(unsigned int count)
+{
+  threads = count;
+  pool.reset();
+}
 
-  positive1D.normalize();
-  negative1D.normalize();
-  positive3D.normalize();
-  negative3D.normalize();
+bool BayesClassifier::setPrecision(int format)
+{
+  if (format < POSTERIOR_DOUBLE || format > POSTERIOR_U8) {
+    return false;
+  }
 
+  // Posterior of trained model is computed again in new format
+  // (from histograms, which are copied from loaded model)
+  if (format != table_format && hasPosterior()) {
+    restoreCounts();
+    stale.value = true;
+  }
+
+  precision = format;
   return true;
 }
 
-double BayesClassifier::predict(bitmap_image sample)
+int BayesClassifier::getPrecision() const
 {
-  const unsigned int height = sample.height();
-  const unsigned int width  = sample.width();
+  return precision;
+}
 
-  unsigned char r, g, b;
-  double prob = 0;
+bool BayesClassifier::merge(const BayesClassifier &model)
+{
+  if (method != model.method || quant != model.quant || subsample != model.subsample ||
+      layout != model.layout) {
+    return false;
+  }
 
-  // Classify each pixel of input image
-  for (std::size_t y = 0; y < height; y += subsample) {
-    for (std::size_t x = 0; x < width; x += subsample) {
+  // Histograms of loaded model are needed, counts of other
+  // loaded model are read from its file
+  restoreCounts();
+
+  model.forEachCount([this](std::size_t bin, unsigned long positive, unsigned long negative) {
+    addCounts(bin, positive, negative);
+  });
+
+  number_of_samples += model.number_of_samples;
+
+  positive_samples += model.positive_samples;
+  negative_samples += model.negative_samples;
+
+  stale.value = true;
+  return true;
+}
+
+bool BayesClassifier::derive(BayesClassifier &model) const
+{
+  if (&model == this || model.quant < quant || model.subsample != subsample ||
+      (model.method == BAYESIAN_RGB && method != BAYESIAN_RGB)) {
+    return false;
+  }
+
+  model.resetCounts();
+
+  // Bin of coarser model contains 2^k bins of this model in each
+  // dimension, green and blue of RGB model are ignored by R model
+  // (marginalized), counts of loaded model are read from its file
+  const unsigned int k = model.shift - shift;
+
+  forEachCount([&](std::size_t n, unsigned long positive, unsigned long negative) {
+    unsigned int r, g, b;
+
+    binColor(n, r, g, b);
+    model.addCounts(model.colorBin(r >> k, g >> k, b >> k), positive, negative);
+  });
+
+  model.number_of_samples = number_of_samples;
+  model.positive_samples = positive_samples;
+  model.negative_samples = negative_samples;
+
+  model.computeModel();
+  return true;
+}
+
+double BayesClassifier::predict(const ImageView &sample) const
+{
+  // Large images are scored in parallel
+  const std::size_t pixels = (std::size_t)sample.width * sample.height;
+  const bool parallel = (pixels >= PREDICT_PARALLEL_PIXELS && threads != 1);
 
-      sample.get_pixel(x, y, r, g, b);
+  return predict(sample, (parallel) ? &getPool() : 0);
+}
 
-      // Quantization
-      r /= quant;
-      g /= quant;
-      b /= quant;
+double BayesClassifier::predict(const ImageView &sample, ThreadPool *pool) const
+{
+  refreshPosterior();
 
-      // Compute P(x|w) and P(x|-w)
-      double positive = (method == BAYESIAN_R) ? positive1D(r) : positive3D(r, g, b);
-      double negative = (method == BAYESIAN_R) ? negative1D(r) : negative3D(r, g, b);
+  if (!hasPosterior()) {
+    std::cerr << "Model is not trained." << std::endl;
+    return 0;
+  }
 
-      // Compute evidence P(x) = P(x|w)P(w) + P(x|-w)P(-w)
-      double evidence = prior * positive + (1 - prior) * negative;
-      evidence = (evidence > 0) ? evidence : evidence + 0.00001;
+  const unsigned int rows  = (sample.height + subsample - 1) / subsample;
+  const unsigned int bands = (rows + PREDICT_BAND_ROWS - 1) / PREDICT_BAND_ROWS;
 
-      // Compute posterior probability P(w|x)
-      double posterior = (positive * prior) / evidence;
+  // Split image into bands of rows, sum of each band is computed
+  // separately, so the result does not depend on number of threads
+  std::vector<double> band_sum(bands, 0);
 
-      prob += posterior;
+  if (pool != 0 && bands > 1) {
+    pool->run(bands, [&](unsigned int band, unsigned int) {
+      band_sum.at(band) = predictRows(sample, band * PREDICT_BAND_ROWS, (band + 1) * PREDICT_BAND_ROWS);
+    });
+  } else {
+    for (unsigned int band = 0; band < bands; band++) {
+      band_sum.at(band) = predictRows(sample, band * PREDICT_BAND_ROWS, (band + 1) * PREDICT_BAND_ROWS);
     }
   }
 
+  double prob = 0;
+
+  for (unsigned int band = 0; band < bands; band++) {
+    prob += band_sum.at(band);
+  }
+
   // Return average posterior probability
-  return prob / (((double)width / subsample) * ((double)height / subsample));
+  return prob / normalization(sample);
+}
+
+std::vector<double> BayesClassifier::predict(const std::vector<ImageView> &samples) const
+{
+  std::vector<double> probs(samples.size(), 0);
+
+  // Few samples are split into bands of rows instead
+  if (threads == 1 || samples.size() < getPool().size()) {
+    for (unsigned int i = 0; i < samples.size(); i++) {
+      probs.at(i) = predict(samples.at(i));
+    }
+    return probs;
+  }
+
+  // Order samples by decreasing size, threads take next sample when they
+  // finish previous one, so small samples fill in gaps at the end
+  std::vector<std::pair<std::size_t, unsigned int> > order;
+
+  for (unsigned int i = 0; i < samples.size(); i++) {
+    order.push_back(std::make_pair((std::size_t)samples.at(i).width * samples.at(i).height, i));
+  }
+  std::stable_sort(order.begin(), order.end(), std::greater<std::pair<std::size_t, unsigned int> >());
+
+  // Each sample is scored serially by one thread of the pool
+  getPool().run(samples.size(), [&](unsigned int i, unsigned int) {
+    const unsigned int n = order.at(i).second;
+    probs.at(n) = predict(samples.at(n), 0);
+  });
+
+  return probs;
 }
 
-unsigned int BayesClassifier::getTrainingSize()
+double BayesClassifier::predictRows(const ImageView &sample, unsigned int first, unsigned int last) const
+{
+  const unsigned int height = sample.height;
+  const unsigned int count  = (sample.width + subsample - 1) / subsample;
+
+  // Table is read in its stored format (see setPrecision)
+  const void *table = getPosterior();
+  const int format = table_format;
+  const std::size_t size = getHistogramSize();
+
+  // Bins of sparse posterior are translated to offsets of its blocks
+  const bool blocks = (table == 0 && sparse);
+
+  const unsigned int *index = 0;
+
+  if (blocks) {
+    table = getSparsePosterior();
+    index = getBlockIndex();
+  }
+
+  std::vector<unsigned int> bins(count + 1);
+  double prob = 0;
+  unsigned long long fixed = 0;
+
+  // Classify each pixel of rows, ie sum precomputed
+  // posterior probabilities P(w|x) of pixel bins row by row
+  for (std::size_t y = first * subsample; y < last * subsample && y < height; y += subsample) {
+    bin_kernel(sample.row(y), count, subsample, sample.redOffset(), sample.blueOffset(), &bins[0]);
+
+    if (blocks) {
+      resolveBins(&bins[0], count, index, SPARSE_BLOCK_BITS);
+    }
+
+    if (format == POSTERIOR_U8) {
+      fixed += sumBins(&bins[0], count, (const uint8_t *)table, size);
+    } else if (format == POSTERIOR_U16) {
+      fixed += sumBins(&bins[0], count, (const uint16_t *)table, size);
+    } else if (format == POSTERIOR_FLOAT) {
+      prob += sumBins(&bins[0], count, (const float *)table, size);
+    } else {
+      prob += sumBins(&bins[0], count, (const double *)table, size);
+    }
+  }
+
+  // Fixed point sum is exact, it is scaled only once
+  if (format == POSTERIOR_U8) {
+    return fixed / 255.0;
+  } else if (format == POSTERIOR_U16) {
+    return fixed / 65535.0;
+  }
+  return prob;
+}
+
+unsigned int BayesClassifier::getTrainingSize() const
 {
   return number_of_samples;
 }
 
-void BayesClassifier::addSample(bitmap_image sample, bool positive)
+unsigned int BayesClassifier::getHistogramSize() const
+{
+  const unsigned int d = 256 >> shift;
+  return (method == BAYESIAN_RGB) ? d * d * d : d;
+}
+
+void BayesClassifier::histogram(const ImageView &sample, std::vector<bin_count_t> &bins)
+{
+  const unsigned int height = sample.height;
+  const unsigned int count  = (sample.width + subsample - 1) / subsample;
+
+  std::vector<unsigned int> row_bins(count + 1);
+
+  bins.clear();
+  bin_counter.resize(getHistogramSize(), 0);
+
+  // Count pixels and remember each used bin once
+  for (std::size_t y = 0; y < height; y += subsample) {
+    bin_kernel(sample.row(y), count, subsample, sample.redOffset(), sample.blueOffset(), &row_bins[0]);
+
+    for (unsigned int x = 0; x < count; x++) {
+      if (bin_counter[row_bins[x]]++ == 0) {
+        bins.push_back(bin_count(row_bins[x], 0));
+      }
+    }
+  }
+
+  // Move counts to output and clear counters for next sample
+  for (unsigned int i = 0; i < bins.size(); i++) {
+    bins[i].count = bin_counter[bins[i].bin];
+    bin_counter[bins[i].bin] = 0;
+  }
+}
+
+double BayesClassifier::normalization(const ImageView &sample) const
+{
+  return ((double)sample.width / subsample) * ((double)sample.height / subsample);
+}
+
+double BayesClassifier::posterior(double positive, double negative, double prior)
+{
+  // Compute evidence P(x) = P(x|w)P(w) + P(x|-w)P(-w)
+  double evidence = prior * positive + (1 - prior) * negative;
+  evidence = (evidence > 0) ? evidence : evidence + 0.00001;
+
+  // Compute posterior probability P(w|x)
+  return (positive * prior) / evidence;
+}
+
+void BayesClassifier::addSample(const ImageView &sample, bool positive)
 {
   if (positive) {
-    if (method == BAYESIAN_RGB) {
+    if (sparse) {
+      addHistogram(sparse_positive, sample);
+    } else if (method == BAYESIAN_RGB) {
       addHistogram(positive3D, sample);
     } else {
       addHistogram(positive1D, sample);
     }
     positive_samples++;
   } else {
-    if (method == BAYESIAN_RGB) {
+    if (sparse) {
+      addHistogram(sparse_negative, sample);
+    } else if (method == BAYESIAN_RGB) {
       addHistogram(negative3D, sample);
     } else {
       addHistogram(negative1D, sample);
@@ -174,26 +473,676 @@ void BayesClassifier::addSample(bitmap_image sample, bool positive)
   }
 }
 
-template <typename T, unsigned int dim>
-void BayesClassifier::addHistogram(vector<T, dim> &histogram, bitmap_image image)
+void BayesClassifier::addSamples(unsigned int count,
+                                 const std::function<bool(unsigned int, BayesClassifier &)> &sample,
+                                 std::vector<char> &added)
 {
-  const unsigned int height = image.height();
-  const unsigned int width  = image.width();
+  added.assign(count, false);
+  restoreCounts();
+
+  // Each worker owns a partial model (limited by memory of histograms).
+  // Sparse partial models are expected to be as occupied as this model,
+  // but at least as large as dense tables below SPARSE_TABLE_MEMORY
+  std::size_t model_size = 2 * sizeof(unsigned long) * getHistogramSize();
+
+  if (sparse) {
+    model_size = std::min(model_size, std::max(sparse_positive.memory() + sparse_negative.memory(),
+                                               2 * SPARSE_TABLE_MEMORY));
+  }
 
-  unsigned char r, g, b;
+  ThreadPool &pool = getPool();
+
+  unsigned int workers = std::min<std::size_t>(pool.size(), count);
+  workers = std::min<std::size_t>(workers, std::max<std::size_t>(1, TRAIN_PARTIAL_MEMORY / model_size));
+
+  if (workers <= 1) {
+    for (unsigned int i = 0; i < count; i++) {
+      added.at(i) = sample(i, *this);
+    }
+    return;
+  }
+
+  std::vector<BayesClassifier> partial(workers, BayesClassifier(quant, method, subsample > 1, layout));
+
+  // Partial model w takes samples w, w + workers, ..., so samples are
+  // taken in order of loading even if the pool has more threads
+  pool.run(workers, [&](unsigned int w, unsigned int) {
+    for (unsigned int i = w; i < count; i += workers) {
+      added.at(i) = sample(i, partial.at(w));
+    }
+  });
+
+  // Tree reduction of partial models, counts are integers,
+  // so the result does not depend on number of workers
+  for (unsigned int stride = 1; stride < workers; stride *= 2) {
+    pool.run((workers + 2 * stride - 1) / (2 * stride), [&](unsigned int i, unsigned int) {
+      if (2 * stride * i + stride < workers) {
+        partial.at(2 * stride * i).merge(partial.at(2 * stride * i + stride));
+      }
+    });
+  }
+
+  merge(partial.at(0));
+}
+
+ThreadPool & BayesClassifier::getPool() const
+{
+  std::shared_ptr<ThreadPool> current = std::atomic_load(&pool);
+
+  // Pool is created once even if more threads predict at once
+  if (!current) {
+    std::shared_ptr<ThreadPool> created = std::make_shared<ThreadPool>(threads);
+
+    if (std::atomic_compare_exchange_strong(&pool, &current, created)) {
+      current = created;
+    }
+  }
+  return *current;
+}
+
+void BayesClassifier::refreshPosterior() const
+{
+  // Lock is taken only while posterior is stale, tables computed
+  // by other thread are visible after the flag is read as false
+  if (!stale.value.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(*refresh_lock);
+
+  if (stale.value.load(std::memory_order_relaxed)) {
+    computeTables();
+  }
+}
+
+bool BayesClassifier::hasPosterior() const
+{
+  return mapped_posterior != 0 || getPosterior() != 0 || (sparse && sparse_posterior.size() > 0);
+}
+
+void BayesClassifier::computeModel()
+{
+  // Posterior of loaded model is replaced
+  restoreCounts();
+  computeTables();
+}
+
+void BayesClassifier::computeTables() const
+{
+  model_file.reset();
+  mapped_posterior = 0;
+  mapped_index = 0;
+
+  // Compute prior probability
+  prior = (double) positive_samples / (positive_samples + negative_samples);
+
+  if (sparse) {
+    computePosterior(sparse_posterior, sparse_positive, sparse_negative);
+  } else if (method == BAYESIAN_RGB) {
+    computePosterior(posterior3D, positive3D, negative3D);
+  } else {
+    computePosterior(posterior1D, positive1D, negative1D);
+  }
+
+  compactPosterior();
+
+  // Tables are published to predicting threads
+  stale.value.store(false, std::memory_order_release);
+}
+
+const void * BayesClassifier::getPosterior() const
+{
+  // Sparse posterior is not contiguous
+  if (mapped_posterior != 0) {
+    return (mapped_index == 0) ? mapped_posterior : 0;
+  }
+
+  if (sparse) {
+    return 0;
+  }
+
+  if (table_format != POSTERIOR_DOUBLE) {
+    return (compact_posterior.empty()) ? 0 : &compact_posterior[0];
+  }
+  return (method == BAYESIAN_R) ? posterior1D.ptr() : posterior3D.ptr();
+}
+
+const void * BayesClassifier::getSparsePosterior() const
+{
+  if (mapped_posterior != 0) {
+    return mapped_posterior;
+  }
+
+  if (table_format != POSTERIOR_DOUBLE) {
+    return (compact_posterior.empty()) ? 0 : &compact_posterior[0];
+  }
+  return sparse_posterior.dataPtr();
+}
+
+const unsigned int * BayesClassifier::getBlockIndex() const
+{
+  return (mapped_posterior != 0) ? mapped_index : sparse_posterior.indexPtr();
+}
+
+void BayesClassifier::compactPosterior() const
+{
+  table_format = precision;
+  compact_posterior.clear();
+
+  if (precision == POSTERIOR_DOUBLE) {
+    compact_posterior.shrink_to_fit();
+    return;
+  }
+
+  // Elements of sparse table are converted including the zero block,
+  // so the block index of sparse_posterior is valid for both tables
+  const double *table = (sparse) ? sparse_posterior.dataPtr()
+                      : (method == BAYESIAN_RGB) ? posterior3D.ptr() : posterior1D.ptr();
+  const std::size_t size = (sparse) ? sparse_posterior.stored()
+                         : (method == BAYESIAN_RGB) ? posterior3D.size() : posterior1D.size();
+
+  compact_posterior.resize(size * posteriorSize(precision) + FIXED_TABLE_PADDING, 0);
+
+  float *float_table = (float *)&compact_posterior[0];
+  uint16_t *u16_table = (uint16_t *)&compact_posterior[0];
+  uint8_t *u8_table = (uint8_t *)&compact_posterior[0];
+
+  for (std::size_t n = 0; n < size; n++) {
+    const double p = std::min(std::max(table[n], 0.0), 1.0);
+
+    if (precision == POSTERIOR_FLOAT) {
+      float_table[n] = (float)p;
+    } else if (precision == POSTERIOR_U16) {
+      u16_table[n] = (uint16_t)(p * 65535 + 0.5);
+    } else {
+      u8_table[n] = (uint8_t)(p * 255 + 0.5);
+    }
+  }
+}
+
+std::size_t BayesClassifier::posteriorSize(int format)
+{
+  if (format == POSTERIOR_FLOAT) {
+    return sizeof(float);
+  } else if (format == POSTERIOR_U16) {
+    return sizeof(uint16_t);
+  } else if (format == POSTERIOR_U8) {
+    return sizeof(uint8_t);
+  }
+  return sizeof(double);
+}
+
+void BayesClassifier::restoreCounts()
+{
+  if (mapped_positive == 0) {
+    return;
+  }
+
+  const uint64_t *positive = mapped_positive;
+  const uint64_t *negative = mapped_negative;
+
+  resetCounts();
+
+  // Blocks of sparse tables are allocated only for used bins
+  forEachMappedCount(positive, negative, [this](std::size_t n, unsigned long positive_count,
+                                                unsigned long negative_count) {
+    addCounts(n, positive_count, negative_count);
+  });
+}
+
+void BayesClassifier::resetCounts()
+{
+  const std::size_t d = 256 >> shift;
+
+  positive1D = vector1UL();
+  negative1D = vector1UL();
+  positive3D = vector3UL();
+  negative3D = vector3UL();
+  sparse_positive = SparseTable<unsigned long>();
+  sparse_negative = SparseTable<unsigned long>();
+
+  if (sparse) {
+    sparse_positive = SparseTable<unsigned long>(getHistogramSize());
+    sparse_negative = SparseTable<unsigned long>(getHistogramSize());
+  } else if (method == BAYESIAN_RGB) {
+    positive3D = vector3UL(d, 0);
+    negative3D = vector3UL(d, 0);
+  } else {
+    positive1D = vector1UL(d, 0);
+    negative1D = vector1UL(d, 0);
+  }
+
+  mapped_positive = 0;
+  mapped_negative = 0;
+}
+
+std::size_t BayesClassifier::colorBin(unsigned int r, unsigned int g, unsigned int b) const
+{
+  const std::size_t d = 256 >> shift;
+
+  if (method == BAYESIAN_R) {
+    return r;
+  } else if (layout == LAYOUT_MORTON) {
+    return mortonBin(r, g, b);
+  }
+  return r + g * d + b * d * d;
+}
+
+void BayesClassifier::binColor(std::size_t bin, unsigned int &r, unsigned int &g, unsigned int &b) const
+{
+  const std::size_t d = 256 >> shift;
+
+  if (method == BAYESIAN_R) {
+    r = bin;
+    g = b = 0;
+  } else if (layout == LAYOUT_MORTON) {
+    mortonColor(bin, r, g, b);
+  } else {
+    r = bin % d;
+    g = (bin / d) % d;
+    b = bin / (d * d);
+  }
+}
+
+void BayesClassifier::addCounts(std::size_t bin, unsigned long positive, unsigned long negative)
+{
+  if (sparse) {
+    sparse_positive[bin] += positive;
+    sparse_negative[bin] += negative;
+  } else if (method == BAYESIAN_RGB) {
+    positive3D[bin] += positive;
+    negative3D[bin] += negative;
+  } else {
+    positive1D[bin] += positive;
+    negative1D[bin] += negative;
+  }
+}
+
+unsigned long BayesClassifier::getCount(std::size_t bin, bool positive) const
+{
+  if (sparse) {
+    return (positive) ? sparse_positive.get(bin) : sparse_negative.get(bin);
+  } else if (method == BAYESIAN_RGB) {
+    return (positive) ? positive3D[bin] : negative3D[bin];
+  }
+  return (positive) ? positive1D[bin] : negative1D[bin];
+}
+
+void BayesClassifier::forEachCount(const std::function<void(std::size_t, unsigned long, unsigned long)> &count) const
+{
+  if (mapped_positive != 0) {
+    forEachMappedCount(mapped_positive, mapped_negative, count);
+  } else if (sparse) {
+    for (std::size_t b = 0; b < sparse_positive.blocks(); b++) {
+      if (!sparse_positive.allocated(b) && !sparse_negative.allocated(b)) {
+        continue;
+      }
+
+      const std::size_t first = b << SPARSE_BLOCK_BITS;
+      const std::size_t last = std::min(first + SparseTable<unsigned long>::BLOCK, sparse_positive.size());
+
+      for (std::size_t n = first; n < last; n++) {
+        count(n, sparse_positive[n], sparse_negative[n]);
+      }
+    }
+  } else if (method == BAYESIAN_RGB) {
+    for (std::size_t n = 0; n < positive3D.size(); n++) {
+      count(n, positive3D[n], negative3D[n]);
+    }
+  } else {
+    for (std::size_t n = 0; n < positive1D.size(); n++) {
+      count(n, positive1D[n], negative1D[n]);
+    }
+  }
+}
+
+void BayesClassifier::forEachMappedCount(const uint64_t *positive, const uint64_t *negative,
+                                         const std::function<void(std::size_t, unsigned long, unsigned long)> &count) const
+{
+  const std::size_t size = getHistogramSize();
+
+  for (std::size_t first = 0; first < size; first += SparseTable<unsigned long>::BLOCK) {
+    const std::size_t last = std::min(first + SparseTable<unsigned long>::BLOCK, size);
+    std::size_t offset = first;
+
+    // Blocks of sparse tables without samples are not stored
+    if (mapped_index != 0) {
+      offset = mapped_index[first >> SPARSE_BLOCK_BITS];
+
+      if (offset == 0) {
+        continue;
+      }
+    }
+
+    for (std::size_t n = first; n < last; n++, offset++) {
+      if (positive[offset] != 0 || negative[offset] != 0) {
+        count(n, positive[offset], negative[offset]);
+      }
+    }
+  }
+}
+
+bool BayesClassifier::save(std::string path)
+{
+  refresh();
+
+  const void *table = getPosterior();
+
+  if (!hasPosterior()) {
+    std::cerr << "Model is not trained." << std::endl;
+    return false;
+  }
+
+  restoreCounts();
+
+  std::ofstream output(path.c_str(), std::ios::binary);
+
+  if (!output.is_open()) {
+    return false;
+  }
+
+  const uint64_t bins = getHistogramSize();
+  const std::size_t block = SparseTable<unsigned long>::BLOCK;
+  const std::size_t element = posteriorSize(table_format);
+
+  // Blocks of sparse model with samples are stored after the zero block
+  // (bins of sparse models are whole blocks)
+  std::vector<uint32_t> index;
+  uint64_t stored = bins;
+
+  if (sparse) {
+    index.assign(sparse_positive.blocks(), 0);
+    stored = block;
+
+    for (std::size_t b = 0; b < index.size(); b++) {
+      if (sparse_positive.allocated(b) || sparse_negative.allocated(b)) {
+        index[b] = stored;
+        stored += block;
+      }
+    }
+  }
+
+  const uint64_t table_size = (stored * sizeof(uint64_t) + 63) & ~(uint64_t)63;
+  const uint64_t index_size = (index.size() * sizeof(uint32_t) + 63) & ~(uint64_t)63;
+
+  model_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+
+  header.version = MODEL_VERSION;
+  header.method = method;
+  header.quantization = quant;
+  header.subsample = subsample;
+  header.prior = prior;
+  header.number_of_samples = number_of_samples;
+  header.positive_samples = positive_samples;
+  header.negative_samples = negative_samples;
+  header.bins = bins;
+  header.index_offset = (sparse) ? (sizeof(header) + 63) & ~(uint64_t)63 : 0;
+  header.stored = (sparse) ? stored : 0;
+  header.positive_offset = ((sizeof(header) + 63) & ~(uint64_t)63) + index_size;
+  header.negative_offset = header.positive_offset + table_size;
+  header.posterior_offset = header.negative_offset + table_size;
+  header.layout = layout;
+  header.posterior_format = table_format;
+
+  std::vector<char> padding(header.positive_offset - sizeof(header), 0);
+  std::vector<uint64_t> counts(block, 0);
+
+  output.write((const char *)&header, sizeof(header));
+
+  if (sparse) {
+    output.write(&padding[0], header.index_offset - sizeof(header));
+    output.write((const char *)&index[0], index.size() * sizeof(uint32_t));
+    output.write(&padding[0], index_size - index.size() * sizeof(uint32_t));
+  } else {
+    output.write(&padding[0], padding.size());
+  }
+
+  // Write histograms by blocks (stored blocks of sparse tables)
+  for (int positive = 1; positive >= 0; positive--) {
+    if (sparse) {
+      const SparseTable<unsigned long> &table = (positive) ? sparse_positive : sparse_negative;
+      output.write((const char *)&counts[0], block * sizeof(uint64_t));
+
+      for (std::size_t b = 0; b < index.size(); b++) {
+        if (index[b] != 0) {
+          output.write((const char *)table.block(b), block * sizeof(uint64_t));
+        }
+      }
+      continue;
+    }
+
+    for (std::size_t first = 0; first < table_size / sizeof(uint64_t); first += counts.size()) {
+      const std::size_t length = std::min(counts.size(), table_size / sizeof(uint64_t) - first);
+
+      for (std::size_t n = 0; n < length; n++) {
+        counts[n] = (first + n < bins) ? getCount(first + n, positive) : 0;
+      }
+      output.write((const char *)&counts[0], length * sizeof(uint64_t));
+    }
+  }
+
+  // Write posterior table in format of the model, blocks of sparse
+  // posterior are read from dense table of models loaded densely
+  if (!sparse) {
+    output.write((const char *)table, bins * element);
+  } else {
+    const char *data = (const char *)((table != 0) ? table : getSparsePosterior());
+    const unsigned int *blocks = (table != 0) ? 0 : getBlockIndex();
+
+    output.write((const char *)&counts[0], block * element);
+
+    for (std::size_t b = 0; b < index.size(); b++) {
+      if (index[b] != 0) {
+        const std::size_t offset = (blocks != 0) ? blocks[b] : b * block;
+        output.write(data + offset * element, block * element);
+      }
+    }
+  }
+
+  // Fixed point table is read by 32-bit words in place
+  std::vector<char> table_padding(FIXED_TABLE_PADDING, 0);
+
+  if (table_format == POSTERIOR_U16 || table_format == POSTERIOR_U8) {
+    output.write(&table_padding[0], table_padding.size());
+  }
+
+  return output.good();
+}
+
+bool BayesClassifier::load(std::string path)
+{
+  std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+
+  if (!file->open(path) || file->size() < sizeof(model_header_t)) {
+    std::cerr << "Failed to open model " << path << "." << std::endl;
+    return false;
+  }
+
+  const model_header_t *header = (const model_header_t *)file->data();
+
+  // Check model format and parameters
+  const int q = header->quantization;
+  const uint64_t d = (q > 0) ? 256 / q : 0;
+  const uint64_t bins = (header->method == BAYESIAN_RGB) ? d * d * d : d;
+
+  if (memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version < 1 || header->version > MODEL_VERSION) {
+    std::cerr << "File " << path << " is not model of supported version." << std::endl;
+    return false;
+  }
+
+  // Tables of version 1 are in linear order,
+  // posterior of version 1 and 2 is double
+  const int layout_order = (header->version >= 2) ? header->layout : LAYOUT_LINEAR;
+  const int format = (header->version >= 3) ? header->posterior_format : POSTERIOR_DOUBLE;
+  const std::size_t element = posteriorSize(format);
+  const std::size_t table_padding = (format == POSTERIOR_U16 || format == POSTERIOR_U8) ? FIXED_TABLE_PADDING : 0;
+
+  // Tables of sparse models are stored by blocks since version 4,
+  // the model must be sparse also in memory (see setParameters)
+  const uint64_t stored = (header->version >= 4) ? header->stored : 0;
+  const uint64_t blocks = (bins + SparseTable<unsigned long>::MASK) >> SPARSE_BLOCK_BITS;
+  const uint64_t elements = (stored != 0) ? stored : bins;
+  const bool sparse_model = (header->method == BAYESIAN_RGB && bins * sizeof(double) > SPARSE_TABLE_MEMORY);
+
+  // Check that table of length bytes at offset is in file
+  // (compared without overflow of offset + length)
+  auto fits = [&file](uint64_t offset, uint64_t length) {
+    return offset <= file->size() && length <= file->size() - offset;
+  };
+
+  if ((header->method != BAYESIAN_R && header->method != BAYESIAN_RGB) ||
+      q <= 0 || q > 256 || (q & (q - 1)) != 0 || header->bins != bins ||
+      (header->subsample != 1 && header->subsample != 2) ||
+      (layout_order != LAYOUT_LINEAR && layout_order != LAYOUT_MORTON) ||
+      format < POSTERIOR_DOUBLE || format > POSTERIOR_U8 ||
+      header->positive_offset % 8 != 0 || header->negative_offset % 8 != 0 ||
+      header->posterior_offset % 8 != 0 ||
+      (stored != 0 && (!sparse_model || stored % SparseTable<unsigned long>::BLOCK != 0 ||
+                       stored > file->size() || header->index_offset % 4 != 0 ||
+                       !fits(header->index_offset, blocks * sizeof(uint32_t)))) ||
+      !fits(header->positive_offset, elements * sizeof(uint64_t)) ||
+      !fits(header->negative_offset, elements * sizeof(uint64_t)) ||
+      !fits(header->posterior_offset, elements * element + table_padding)) {
+    std::cerr << "Model " << path << " is corrupted." << std::endl;
+    return false;
+  }
+
+  // Blocks of sparse tables must be in the tables
+  const uint32_t *index = (stored != 0) ? (const uint32_t *)(file->data() + header->index_offset) : 0;
+
+  for (uint64_t b = 0; index != 0 && b < blocks; b++) {
+    if (index[b] % SparseTable<unsigned long>::BLOCK != 0 || index[b] >= stored) {
+      std::cerr << "Model " << path << " is corrupted." << std::endl;
+      return false;
+    }
+  }
+
+  // Parameters of the model replace parameters of this classifier
+  // (threads and shard are kept)
+  setParameters(q, header->method, header->subsample > 1, layout_order);
+
+  prior = header->prior;
+  precision = format;
+  table_format = format;
+  stale.value = false;
+
+  number_of_samples = header->number_of_samples;
+  positive_samples = header->positive_samples;
+  negative_samples = header->negative_samples;
+
+  // Tables are used in place, histograms are copied only when needed
+  positive1D = vector1UL();
+  negative1D = vector1UL();
+  positive3D = vector3UL();
+  negative3D = vector3UL();
+  sparse_positive = SparseTable<unsigned long>();
+  sparse_negative = SparseTable<unsigned long>();
+
+  posterior1D = vector1D();
+  posterior3D = vector3D();
+  sparse_posterior = SparseTable<double>();
+
+  compact_posterior.clear();
+  compact_posterior.shrink_to_fit();
+  bin_counter.clear();
+
+  model_file = file;
+  mapped_positive = (const uint64_t *)(file->data() + header->positive_offset);
+  mapped_negative = (const uint64_t *)(file->data() + header->negative_offset);
+  mapped_posterior = file->data() + header->posterior_offset;
+  mapped_index = index;
+
+  return true;
+}
+
+template <typename H>
+void BayesClassifier::addHistogram(H &histogram, const ImageView &image)
+{
+  const unsigned int height = image.height;
+  const unsigned int count  = (image.width + subsample - 1) / subsample;
+  const std::size_t size = histogram.size();
+
+  // Sub-histograms pay off only if they are small and the image is
+  // large compared to them (they are merged after each image)
+  const std::size_t pixels = (std::size_t)count * ((height + subsample - 1) / subsample);
+  const unsigned int copies = (size <= HISTOGRAM_COPIES_MAX_BINS && pixels >= HISTOGRAM_COPIES * size)
+                              ? HISTOGRAM_COPIES : 1;
+
+  if (count == 0) {
+    return;
+  }
+
+  std::vector<unsigned int> bins(count);
+  std::vector<unsigned int> counts((copies > 1) ? copies * size : 0, 0);
 
   // Compute histogram
   for (std::size_t y = 0; y < height; y += subsample) {
-    for (std::size_t x = 0; x < width; x += subsample) {
-
-      image.get_pixel(x, y, r, g, b);
+    bin_kernel(image.row(y), count, subsample, image.redOffset(), image.blueOffset(), &bins[0]);
 
-      if (dim == 1) {
-        histogram.inc(r/quant);
-      } else {
-        histogram.inc(r/quant, g/quant, b/quant);
+    if (copies > 1) {
+      countBins(&bins[0], count, &counts[0], size, copies);
+    } else {
+      for (unsigned int x = 0; x < count; x++) {
+        histogram[bins[x]] += 1;
       }
     }
   }
+
+  // Merge sub-histograms
+  for (std::size_t n = 0; copies > 1 && n < copies * size; n++) {
+    histogram[n % size] += counts[n];
+  }
+}
+
+template <unsigned int dim>
+void BayesClassifier::computePosterior(vector<double, dim> &posterior,
+                                       const vector<unsigned long, dim> &positive,
+                                       const vector<unsigned long, dim> &negative) const
+{
+  // Likelihoods P(x|w) and P(x|-w) are counts normalized by sum of counts
+  const double positive_sum = positive.sum();
+  const double negative_sum = negative.sum();
+
+  posterior = vector<double, dim>(positive.dimension(), 0);
+
+  for (std::size_t n = 0; n < posterior.size(); n++) {
+    posterior[n] = BayesClassifier::posterior(positive[n] / positive_sum,
+                                              negative[n] / negative_sum, prior);
+  }
 }
 
+void BayesClassifier::computePosterior(SparseTable<double> &posterior,
+                                       const SparseTable<unsigned long> &positive,
+                                       const SparseTable<unsigned long> &negative) const
+{
+  const double positive_sum = positive.sum();
+  const double negative_sum = negative.sum();
+
+  posterior = SparseTable<double>(positive.size());
+
+  std::size_t used = 0;
+
+  for (std::size_t b = 0; b < positive.blocks(); b++) {
+    used += (positive.allocated(b) || negative.allocated(b)) ? 1 : 0;
+  }
+  posterior.reserve(used);
+
+  // Blocks without samples keep zero posterior
+  for (std::size_t b = 0; b < positive.blocks(); b++) {
+    if (!positive.allocated(b) && !negative.allocated(b)) {
+      continue;
+    }
+
+    const std::size_t first = b << SPARSE_BLOCK_BITS;
+    const std::size_t last = std::min(first + SparseTable<double>::BLOCK, positive.size());
+    double *table = posterior.block(b);
+
+    for (std::size_t n = first; n < last; n++) {
+      table[n - first] = BayesClassifier::posterior(positive[n] / positive_sum,
+                                            negative[n] / negative_sum, prior);
+    }
+  }
+}
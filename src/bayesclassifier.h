@@ -11,15 +11,88 @@
 #ifndef BAYESCLASSIFIER_H
 #define BAYESCLASSIFIER_H
 
+#include <memory>
+#include <mutex>
+#include <atomic>
+
 #include "bitmap_image.hpp"
+#include "imageview.h"
 #include "nvector.h"
+#include "sparsetable.h"
+#include "kernels.h"
+#include "threadpool.h"
+#include "mappedfile.h"
+#include "mappedbitmap.h"
+#include "imageloader.h"
+#include "modelfile.h"
 
 #define BAYESIAN_R   1
 #define BAYESIAN_RGB 3
 
+// Order of RGB histogram bins, linear (red, then green, then blue)
+// or Morton order (see mortonBin), which keeps bins of similar colors
+// close in memory and fills fewer blocks of sparse tables
+#define LAYOUT_LINEAR 0
+#define LAYOUT_MORTON 1
+
+// Format of posterior table used for prediction. Smaller tables stay
+// in cache. Fixed point formats store round(P(w|x) * (2^bits - 1)) and
+// pixels are summed as integers. Error of each pixel is at most half of
+// the step, so the score (average of pixels) differs from the score
+// computed with doubles by at most:
+//  float - 2^-25 (3.0e-8)
+//  16 bits - 0.5 / 65535 (7.7e-6)
+//  8 bits - 0.5 / 255 (2.0e-3)
+// (subsampled images of odd size sum slightly more pixels than they
+// are divided by, the bound grows by the same ratio)
+#define POSTERIOR_DOUBLE 0
+#define POSTERIOR_FLOAT  1
+#define POSTERIOR_U16    2
+#define POSTERIOR_U8     3
+
+// Memory available for partial models of training threads
+#define TRAIN_PARTIAL_MEMORY (1UL << 30)
+
+// Images with more pixels are predicted in parallel by bands of rows
+#define PREDICT_PARALLEL_PIXELS (1UL << 18)
+#define PREDICT_BAND_ROWS 64
+
+// Number of sample pixels falling into one histogram bin
+typedef struct bin_count {
+
+  unsigned int bin;
+  unsigned int count;
+
+  bin_count(unsigned int b, unsigned int c)
+    : bin(b), count(c) {}
+
+} bin_count_t;
+
+// Flag read by threads without lock, copy of the flag takes its value
+// (std::atomic is not copyable)
+typedef struct shared_flag {
+
+  std::atomic<bool> value;
+
+  shared_flag(bool v = false)
+    : value(v) {}
+
+  shared_flag(const shared_flag &other)
+    : value(other.value.load()) {}
+
+  shared_flag & operator=(const shared_flag &other) {
+    value.store(other.value.load());
+    return *this;
+  }
+
+} shared_flag_t;
+
 // Implementation of Bayes classifier. The classifier is trained
-// on positive and negative images of type bitmap_image and new samples
-// are predicted using the pretrained model.
+// on positive and negative images and new samples are predicted using
+// the pretrained model. Images are passed as ImageView, so pixel data
+// are never copied (bitmap_image converts to ImageView implicitly).
+// Histograms and posterior of RGB models with fine quantization are
+// stored in sparse tables (see SPARSE_TABLE_MEMORY).
 //
 class BayesClassifier
 {
@@ -29,47 +102,261 @@ public:
   //  method_space - use only R (BAYESIAN_R)
   //     or all components (BAYESIAN_RGB) of RGB color space
   //  subsampling - subsample input data
+  //  layout - order of RGB bins, LAYOUT_LINEAR or LAYOUT_MORTON
   BayesClassifier(int quantization,
                   int method_space = BAYESIAN_RGB,
-                  bool subsampling = false);
+                  bool subsampling = false,
+                  int layout = LAYOUT_LINEAR);
 
   // Train model from positive and negative samples
   bool train(std::string positive, std::string negative);
-  bool train(std::vector<bitmap_image> positive,
-             std::vector<bitmap_image> negative);
+  bool train(const std::vector<ImageView> &positive,
+             const std::vector<ImageView> &negative);
+
+  // Add samples to model (online training). Histograms keep pixel
+  // counts, so new samples are added without retraining. Posterior is
+  // recomputed by refresh() or by first prediction, the model must not
+  // be updated while it is used for prediction by other threads.
+  bool update(std::string positive, std::string negative);
+  bool update(const std::vector<ImageView> &positive,
+              const std::vector<ImageView> &negative);
+
+  // Recompute posterior of updated (or merged) model
+  // (otherwise it is recomputed by first prediction)
+  void refresh();
 
-  // Compute probability for input sample
-  double predict(bitmap_image sample);
+  // Use only images on lines index, index + count, index + 2*count, ...
+  // of training text files (sharded training, shards are merged later)
+  bool setShard(unsigned int index, unsigned int count);
+
+  // Set number of threads used for training and prediction
+  // of large images (0 - number of CPU cores)
+  void setThreads(unsigned int count);
+
+  // Set format of posterior table (POSTERIOR_DOUBLE, POSTERIOR_FLOAT,
+  // POSTERIOR_U16 or POSTERIOR_U8). Table of trained or loaded model
+  // is computed in the new format by refresh() or by first prediction.
+  bool setPrecision(int format);
+
+  // Get format of posterior table
+  int getPrecision() const;
+
+  // Add counts of other model (with same parameters) to this model,
+  // merging is exact and associative (histograms are integer counts)
+  bool merge(const BayesClassifier &other);
+
+  // Derive histograms of model with coarser (or same) quantization by
+  // summing bins of this model, BAYESIAN_R model is derived also from
+  // BAYESIAN_RGB model (red marginal). Counts are the same as if model
+  // was trained on the same samples, so one training pass serves all
+  // coarser models. Model must be other classifier with same
+  // subsampling, layout of bins may differ.
+  bool derive(BayesClassifier &model) const;
+
+  // Save trained model (parameters, histograms and posterior table)
+  bool save(std::string path);
+
+  // Load model saved by save(), parameters of this classifier are
+  // replaced by parameters of the model. The file is mapped into memory
+  // and posterior table is used in place without reading it.
+  bool load(std::string path);
+
+  // Compute probability for input sample. Prediction does not change
+  // the model, so one model may be used by many threads at once
+  // (posterior of updated model is recomputed by first of them, model
+  // which was never trained predicts 0 and reports error).
+  double predict(const ImageView &sample) const;
+
+  // Compute probabilities for many samples on shared thread pool,
+  // larger samples are scheduled first to balance load of threads
+  std::vector<double> predict(const std::vector<ImageView> &samples) const;
+
+  // Compute probability for input sample, bands of rows of the sample
+  // are scored on thread pool (or serially if pool is null)
+  double predict(const ImageView &sample, ThreadPool *pool) const;
 
   // Get number of used training samples
-  unsigned int getTrainingSize();
+  unsigned int getTrainingSize() const;
+
+  // Get number of histogram bins of the model
+  unsigned int getHistogramSize() const;
+
+  // Compute sparse histogram of input sample, ie pairs of bin index
+  // (same as index into posterior table) and number of pixels
+  void histogram(const ImageView &sample, std::vector<bin_count_t> &bins);
+
+  // Get value dividing sum of pixel posteriors in predict()
+  double normalization(const ImageView &sample) const;
+
+  // Compute posterior probability P(w|x) from P(x|w), P(x|-w) and P(w)
+  static double posterior(double positive, double negative, double prior);
 
 protected:
   // Prior probability
-  double prior;
+  mutable double prior;
+
+  // Set quantization, method, subsampling and layout of bins
+  // (tables are not changed)
+  void setParameters(int quantization, int method_space, bool subsampling, int layout_order);
 
   // Add sample to model
-  void addSample(bitmap_image sample, bool positive = true);
+  void addSample(const ImageView &sample, bool positive = true);
+
+  // Add samples to model in parallel, sample(i, model) adds i-th sample
+  // to given (partial) model and returns false if sample is not available
+  void addSamples(unsigned int count,
+                  const std::function<bool(unsigned int, BayesClassifier &)> &sample,
+                  std::vector<char> &added);
+
+  // Sum posterior probabilities of pixels in rows first .. last-1
+  // (row indices after subsampling)
+  double predictRows(const ImageView &sample, unsigned int first, unsigned int last) const;
+
+  // Get thread pool shared by copies of this classifier
+  // (created by first caller)
+  ThreadPool & getPool() const;
+
+  // Compute prior and posterior probabilities from histograms
+  void computeModel();
+
+  // Compute prior and posterior tables from histograms, histograms
+  // of loaded model must be restored (see computeModel)
+  void computeTables() const;
+
+  // Compute posterior tables of updated model before prediction,
+  // once for all predicting threads
+  void refreshPosterior() const;
+
+  // Check whether posterior table was computed or loaded
+  bool hasPosterior() const;
+
+  // Get dense posterior table of trained or loaded model in format
+  // of the model (null for sparse table)
+  const void * getPosterior() const;
+
+  // Get sparse posterior table of trained or loaded model in format
+  // of the model (elements are at offsets given by getBlockIndex())
+  const void * getSparsePosterior() const;
+
+  // Get block index of sparse posterior table
+  const unsigned int * getBlockIndex() const;
+
+  // Convert posterior table to compact format of the model
+  void compactPosterior() const;
+
+  // Get size of posterior table element in given format
+  static std::size_t posteriorSize(int format);
+
+  // Copy histograms of loaded model from mapped file
+  // (needed only to update or save the model)
+  void restoreCounts();
+
+  // Replace histograms by empty ones
+  void resetCounts();
+
+  // Get histogram bin of quantized color (only red is used by BAYESIAN_R)
+  std::size_t colorBin(unsigned int r, unsigned int g, unsigned int b) const;
+
+  // Get quantized color of histogram bin
+  void binColor(std::size_t bin, unsigned int &r, unsigned int &g, unsigned int &b) const;
+
+  // Add pixel counts to histogram bin
+  void addCounts(std::size_t bin, unsigned long positive, unsigned long negative);
+
+  // Get pixel count of histogram bin
+  unsigned long getCount(std::size_t bin, bool positive) const;
+
+  // Call count(bin, positive, negative) for histogram bins, bins of
+  // sparse blocks which were never written are skipped (counts of loaded
+  // model are read from the file, bins without samples are skipped)
+  void forEachCount(const std::function<void(std::size_t, unsigned long, unsigned long)> &count) const;
+
+  // Call count(bin, positive, negative) for bins with samples of mapped
+  // histograms (dense or by blocks of mapped_index)
+  void forEachMappedCount(const uint64_t *positive, const uint64_t *negative,
+                          const std::function<void(std::size_t, unsigned long, unsigned long)> &count) const;
 
   // Add new sample to trained model
-  template <typename T, unsigned int dim>
-  void addHistogram(vector<T, dim> &histogram, bitmap_image image);
+  template <typename H>
+  void addHistogram(H &histogram, const ImageView &image);
+
+  // Precompute posterior probability P(w|x) for each histogram bin
+  template <unsigned int dim>
+  void computePosterior(vector<double, dim> &posterior,
+                        const vector<unsigned long, dim> &positive,
+                        const vector<unsigned long, dim> &negative) const;
+
+  // Precompute posterior probability for bins of sparse histograms,
+  // posterior of bins without samples is zero
+  void computePosterior(SparseTable<double> &posterior,
+                        const SparseTable<unsigned long> &positive,
+                        const SparseTable<unsigned long> &negative) const;
 
 private:
   int method;
   int quant;
   int subsample;
+  int layout;
+
+  // log2 of quantization
+  unsigned int shift;
+
+  // Kernel computing bin indices of pixels (selected by constructor)
+  bin_kernel_t bin_kernel;
+
+  unsigned int threads;
+  mutable std::shared_ptr<ThreadPool> pool;
+
+  unsigned int shard_index;
+  unsigned int shard_count;
+
+  // Histograms (pixel counts) of positive and negative samples
+  vector1UL positive1D;
+  vector1UL negative1D;
 
-  vector1D positive1D;
-  vector1D negative1D;
+  vector3UL positive3D;
+  vector3UL negative3D;
 
-  vector3D positive3D;
-  vector3D negative3D;
+  // Posterior tables are computed from histograms also by prediction
+  // of updated model (const, guarded by refresh_lock shared by copies)
+  mutable vector1D posterior1D;
+  mutable vector3D posterior3D;
+
+  // Sparse tables used instead of 3D vectors
+  bool sparse;
+
+  SparseTable<unsigned long> sparse_positive;
+  SparseTable<unsigned long> sparse_negative;
+  mutable SparseTable<double> sparse_posterior;
+
+  // Format of posterior table requested by setPrecision(), format of
+  // stored table (compact or loaded), which is read by prediction and
+  // saved, and posterior converted to it (empty for POSTERIOR_DOUBLE)
+  int precision;
+  mutable int table_format;
+  mutable std::vector<unsigned char, aligned_allocator<unsigned char> > compact_posterior;
+
+  // Histograms changed since posterior was computed
+  mutable shared_flag_t stale;
+  std::shared_ptr<std::mutex> refresh_lock;
+
+  // Loaded model file and its tables
+  mutable std::shared_ptr<MappedFile> model_file;
+
+  const uint64_t *mapped_positive;
+  const uint64_t *mapped_negative;
+  mutable const void *mapped_posterior;
+
+  // Block index of mapped tables of sparse model (null for dense tables)
+  mutable const unsigned int *mapped_index;
 
   unsigned int number_of_samples;
 
   unsigned int positive_samples;
   unsigned int negative_samples;
+
+  // Per-bin counters reused by histogram()
+  std::vector<unsigned int> bin_counter;
 };
 
 #endif // BAYESCLASSIFIER_H
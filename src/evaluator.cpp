@@ -10,120 +10,246 @@
 
 #include "evaluator.h"
 
-Evaluator::Evaluator()
+Evaluator::Evaluator(unsigned int threads)
+  : threads(threads)
 {
 }
 
-bool Evaluator::evaluate(BayesClassifier bayes, std::string positive_path, std::string negative_path,
-                         double threshold, double &precision, double &recall)
+bool Evaluator::evaluate(const BayesClassifier &bayes, std::string positive_path, std::string negative_path,
+                         double threshold, double &precision, double &recall,
+                         std::vector<training_sample_t> *scores)
 {
-  // Read test images
-  if (!readSamples(positive_path, negative_path, &test_positive, &test_negative)) {
+  std::vector<confusion_t> results;
+  std::vector<std::vector<training_sample_t> > set_scores;
+
+  if (!evaluate(bayes, std::vector<test_set_t>(1, test_set(positive_path, negative_path)),
+                threshold, results, (scores != 0) ? &set_scores : 0)) {
     return false;
   }
 
-  // Compute true positive, true negative,
-  // false positive and false negative rate
-  int TP = 0, TN = 0;
-  int FP = 0, FN = 0;
+  // Calculate precision and recall
+  const confusion_t &result = results.at(0);
+  precision = (double)result.TP / (result.TP + result.FN);
+  recall = (double)result.TP / (result.TP + result.FP);
+
+  if (scores != 0) {
+    scores->insert(scores->end(), set_scores.at(0).begin(), set_scores.at(0).end());
+  }
+  return true;
+}
 
-  for (unsigned int i = 0; i < test_positive.size(); i++) {
-    double prob = bayes.predict(test_positive.at(i));
+bool Evaluator::evaluate(const BayesClassifier &bayes, const std::vector<test_set_t> &sets,
+                         double threshold, std::vector<confusion_t> &results,
+                         std::vector<std::vector<training_sample_t> > *scores)
+{
+  // Images of all datasets form one stream, so threads
+  // do not wait for the end of each dataset
+  std::vector<std::string> paths;
+  std::vector<unsigned int> set_index;
+  std::vector<char> labels;
+
+  for (unsigned int n = 0; n < sets.size(); n++) {
+    std::vector<std::string> set_paths;
+    unsigned int positive_count;
+
+    if (!readPaths(sets.at(n).positive, sets.at(n).negative, set_paths, positive_count)) {
+      std::cerr << "Failed to open file " << sets.at(n).positive << " or " << sets.at(n).negative << "." << std::endl;
+      return false;
+    }
 
-    if (prob >  threshold) { TP++; }
-    if (prob <= threshold) { FN++; }
+    for (unsigned int i = 0; i < set_paths.size(); i++) {
+      set_index.push_back(n);
+      labels.push_back(i < positive_count);
+    }
+    paths.insert(paths.end(), set_paths.begin(), set_paths.end());
   }
 
-  for (unsigned int i = 0; i < test_negative.size(); i++) {
-    double prob = bayes.predict(test_negative.at(i));
+  // Test images are loaded ahead and released once scored
+  ImageLoader loader(paths);
+  ThreadPool pool(threads);
+
+  std::vector<std::vector<confusion_t> > partial(pool.size(), std::vector<confusion_t>(sets.size()));
+  std::vector<double> probs((scores != 0) ? paths.size() : 0, 0);
+  std::vector<char> found(paths.size(), false);
 
-    if (prob <= threshold) { TN++; }
-    if (prob >  threshold) { FP++; }
+  pool.run(paths.size(), [&](unsigned int i, unsigned int worker) {
+    std::shared_ptr<MappedBitmap> image = loader.get(i);
+
+    if (!*image) {
+      return;
+    }
+
+    // Compute true positive, true negative,
+    // false positive and false negative rate
+    const double prob = bayes.predict(image->view(), 0);
+    confusion_t &result = partial.at(worker).at(set_index.at(i));
+
+    if (labels.at(i)) {
+      if (prob >  threshold) { result.TP++; }
+      if (prob <= threshold) { result.FN++; }
+    } else {
+      if (prob <= threshold) { result.TN++; }
+      if (prob >  threshold) { result.FP++; }
+    }
+
+    if (scores != 0) {
+      probs.at(i) = prob;
+    }
+    found.at(i) = true;
+  });
+
+  // Sum results of threads
+  results.assign(sets.size(), confusion_t());
+
+  for (unsigned int w = 0; w < partial.size(); w++) {
+    for (unsigned int n = 0; n < sets.size(); n++) {
+      results.at(n).TP += partial.at(w).at(n).TP;
+      results.at(n).TN += partial.at(w).at(n).TN;
+      results.at(n).FP += partial.at(w).at(n).FP;
+      results.at(n).FN += partial.at(w).at(n).FN;
+    }
+  }
+
+  if (scores != 0) {
+    scores->assign(sets.size(), std::vector<training_sample_t>());
+  }
+
+  for (unsigned int i = 0; i < paths.size(); i++) {
+    if (!found.at(i)) {
+      std::cerr << "Image " << paths.at(i) << " not found" << std::endl;
+    } else if (scores != 0) {
+      scores->at(set_index.at(i)).push_back(training_sample(probs.at(i), labels.at(i)));
+    }
   }
 
-  // Calculate precision and recall
-  precision = (double)TP / (TP + FN);
-  recall = (double)TP / (TP + FP);
   return true;
 }
 
 std::vector<training_sample_t> Evaluator::computeThreshold(std::string positive_path, std::string negative_path,
                                                            int quantization, int method, bool subsampling)
 {
-  if (!readSamples(positive_path, negative_path, &train_positive, &train_negative)) {
+  std::vector<std::string> paths;
+  unsigned int positive_count;
+
+  if (!readPaths(positive_path, negative_path, paths, positive_count)) {
     std::cerr << "Failed to open file " << positive_path << " or " << negative_path << "." << std::endl;
     return std::vector<training_sample_t>();
   }
 
+  // Images are loaded ahead of histogram computation
+  ImageLoader loader(paths);
+
   std::vector<training_sample_t> samples;
 
-  // Select one positive sample from trainig dataset, train classifier using
-  // other training samples and compute threshold for choosen one
-  for (unsigned int i = 0; i < train_positive.size(); i++) {
-    training_sample_t test = training_sample(0.0, true);
-    bitmap_image test_from_train_image = train_positive.at(i);
+  BayesClassifier bayes(quantization, method, subsampling);
+  const unsigned int bins = bayes.getHistogramSize();
 
-    std::vector<bitmap_image> train(train_positive);
-    train.erase(train.begin() + i);
+  // Histogram each training image only once and sum counts of each class
+  std::vector<std::vector<bin_count_t> > positive, negative;
+  std::vector<double> positive_norm, negative_norm;
+  std::vector<unsigned long> positive_total(bins, 0), negative_total(bins, 0);
 
-    BayesClassifier bayes(quantization, method, subsampling);
-    bayes.train(train, train_negative);
-    test.probability = bayes.predict(test_from_train_image);
+  unsigned long positive_sum = countSamples(bayes, loader, 0, positive_count,
+                                            positive, positive_norm, positive_total);
+  unsigned long negative_sum = countSamples(bayes, loader, positive_count, paths.size(),
+                                            negative, negative_norm, negative_total);
 
+  const double P = positive.size();
+  const double N = negative.size();
+
+  // Select one positive sample from trainig dataset, derive classifier from
+  // other training samples and compute threshold for choosen one
+  for (unsigned int i = 0; i < positive.size(); i++) {
+    training_sample_t test = training_sample(0.0, true);
+
+    test.probability = predictHeldOut(positive.at(i), positive_norm.at(i),
+                                      positive_total, positive_sum, negative_total, negative_sum,
+                                      (P - 1) / (P - 1 + N), true);
     samples.push_back(test);
   }
 
-  // Select one negative sample from trainig dataset, train classifier using
+  // Select one negative sample from trainig dataset, derive classifier from
   // other training samples and compute threshold for choosen one
-  for (unsigned int i = 0; i < train_negative.size(); i++) {
+  for (unsigned int i = 0; i < negative.size(); i++) {
     training_sample_t test = training_sample(0.0, false);
-    bitmap_image test_from_train_image = train_negative.at(i);
-
-    std::vector<bitmap_image> train(train_negative);
-    train.erase(train.begin() + i);
-
-    BayesClassifier bayes(quantization, method, subsampling);
-    bayes.train(train_positive, train);
-    test.probability = bayes.predict(test_from_train_image);
 
+    test.probability = predictHeldOut(negative.at(i), negative_norm.at(i),
+                                      negative_total, negative_sum, positive_total, positive_sum,
+                                      P / (P + N - 1), false);
     samples.push_back(test);
   }
 
   return samples;
 }
 
-bool Evaluator::readSamples(std::string positive_path, std::string negative_path,
-                            std::vector<bitmap_image> *positive, std::vector<bitmap_image> *negative)
+unsigned long Evaluator::countSamples(BayesClassifier &bayes, ImageLoader &loader,
+                                     unsigned int first, unsigned int last,
+                                     std::vector<std::vector<bin_count_t> > &histograms,
+                                     std::vector<double> &norms, std::vector<unsigned long> &total)
 {
-  std::string image_path;
-  std::ifstream input_positive(positive_path.c_str());
-  std::ifstream input_negative(negative_path.c_str());
+  unsigned long sum = 0;
 
-  if (!input_positive.is_open() || !input_negative.is_open()) {
-    return false;
-  }
+  for (unsigned int i = first; i < last; i++) {
+    std::shared_ptr<MappedBitmap> image = loader.get(i);
+
+    if (!*image) {
+      std::cerr << "Image " << loader.path(i) << " not found" << std::endl;
+      continue;
+    }
 
-  // Read all positive samples
-  while (std::getline(input_positive, image_path)) {
-    bitmap_image image(image_path.c_str());
+    histograms.push_back(std::vector<bin_count_t>());
+    norms.push_back(bayes.normalization(image->view()));
+    bayes.histogram(image->view(), histograms.back());
 
-    if (!image) {
-      std::cerr << "Image " << image_path << " not found" << std::endl;
-    } else {
-      positive->push_back(image);
+    for (unsigned int j = 0; j < histograms.back().size(); j++) {
+      total.at(histograms.back().at(j).bin) += histograms.back().at(j).count;
+      sum += histograms.back().at(j).count;
     }
   }
 
-  // Read all negative samples
-  while (std::getline(input_negative, image_path)) {
-    bitmap_image image(image_path.c_str());
+  return sum;
+}
 
-    if (!image) {
-      std::cerr << "Image " << image_path << " not found" << std::endl;
-    } else {
-      negative->push_back(image);
-    }
+double Evaluator::predictHeldOut(const std::vector<bin_count_t> &sample, double norm,
+                                 const std::vector<unsigned long> &own_total, unsigned long own_sum,
+                                 const std::vector<unsigned long> &other_total, unsigned long other_sum,
+                                 double prior, bool positive)
+{
+  unsigned long sample_sum = 0;
+
+  for (unsigned int i = 0; i < sample.size(); i++) {
+    sample_sum += sample.at(i).count;
+  }
+
+  // Only bins present in held-out sample contribute to its probability,
+  // so the model without the sample is evaluated just for these bins
+  double prob = 0;
+
+  for (unsigned int i = 0; i < sample.size(); i++) {
+    const unsigned int bin   = sample.at(i).bin;
+    const unsigned int count = sample.at(i).count;
+
+    double own   = (double)(own_total.at(bin) - count) / (own_sum - sample_sum);
+    double other = (double)other_total.at(bin) / other_sum;
+
+    double posterior = (positive) ? BayesClassifier::posterior(own, other, prior)
+                                  : BayesClassifier::posterior(other, own, prior);
+    prob += count * posterior;
+  }
+
+  return prob / norm;
+}
+
+bool Evaluator::readPaths(std::string positive_path, std::string negative_path,
+                          std::vector<std::string> &paths, unsigned int &positive_count)
+{
+  std::vector<std::string> negative_paths;
+
+  if (!ImageLoader::readList(positive_path, paths) || !ImageLoader::readList(negative_path, negative_paths)) {
+    return false;
   }
 
+  positive_count = paths.size();
+  paths.insert(paths.end(), negative_paths.begin(), negative_paths.end());
   return true;
 }
@@ -12,8 +12,10 @@
 #define EVALUATOR_H
 
 #include <vector>
+#include <string>
 #include "bayesclassifier.h"
-#include "bitmap_image.hpp"
+#include "mappedbitmap.h"
+#include "imageloader.h"
 
 typedef struct training_sample {
 
@@ -25,32 +27,76 @@ typedef struct training_sample {
 
 } training_sample_t;
 
+// Text files with paths of positive and negative test images
+typedef struct test_set {
+
+  std::string positive;
+  std::string negative;
+
+  test_set(std::string pos, std::string neg)
+    : positive(pos), negative(neg) {}
+
+} test_set_t;
+
+// Numbers of true/false positive and negative classifications
+typedef struct confusion {
+
+  unsigned long TP, TN;
+  unsigned long FP, FN;
+
+  confusion()
+    : TP(0), TN(0), FP(0), FN(0) {}
+
+} confusion_t;
+
 // Evaluation of implemented Bayes classifier
 class Evaluator
 {
 public:
-  Evaluator();
+  // Create evaluator scoring test images by given number
+  // of threads (0 - number of CPU cores)
+  Evaluator(unsigned int threads = 0);
+
+  // Evaluate Bayes classifier using positive and negative image of test dataset.
+  // Images are loaded, scored and released one by one, so memory does not
+  // grow with size of dataset. Scores of samples are added to scores if set.
+  bool evaluate(const BayesClassifier &bayes, std::string positive_path, std::string negative_path,
+                double threshold, double &precision, double &recall,
+                std::vector<training_sample_t> *scores = 0);
 
-  // Evaluate Bayes classifier using positive and negative image of test dataset
-  bool evaluate(BayesClassifier bayes, std::string positive_path, std::string negative_path,
-                double threshold, double &precision, double &recall);
+  // Evaluate Bayes classifier on several test datasets at once. Images of
+  // all datasets are scored in parallel by the shared (read-only) model,
+  // each thread counts its results separately. Scores are in order of
+  // test images (missing images are skipped).
+  bool evaluate(const BayesClassifier &bayes, const std::vector<test_set_t> &sets,
+                double threshold, std::vector<confusion_t> &results,
+                std::vector<std::vector<training_sample_t> > *scores = 0);
 
   // Compute threshold for each sample from training dataset
   std::vector<training_sample_t> computeThreshold(std::string positive_path, std::string negative_path,
                                                   int quantization, int method, bool subsampling);
 
 protected:
-  // Read defined positive and negative samples
-  bool readSamples(std::string positive_path, std::string negative_path,
-                   std::vector<bitmap_image> *positive, std::vector<bitmap_image> *negative);
+  // Histogram each of samples first .. last-1 once as they are loaded,
+  // add its counts to class totals and return number of counted pixels
+  unsigned long countSamples(BayesClassifier &bayes, ImageLoader &loader,
+                             unsigned int first, unsigned int last,
+                             std::vector<std::vector<bin_count_t> > &histograms,
+                             std::vector<double> &norms, std::vector<unsigned long> &total);
 
-private:
-  std::vector<bitmap_image> train_positive;
-  std::vector<bitmap_image> train_negative;
+  // Compute probability of held-out sample using model trained on other
+  // samples, ie with sample counts subtracted from totals of its class
+  double predictHeldOut(const std::vector<bin_count_t> &sample, double norm,
+                        const std::vector<unsigned long> &own_total, unsigned long own_sum,
+                        const std::vector<unsigned long> &other_total, unsigned long other_sum,
+                        double prior, bool positive);
 
-  std::vector<bitmap_image> test_positive;
-  std::vector<bitmap_image> test_negative;
+  // Read paths of positive samples followed by paths of negative samples
+  bool readPaths(std::string positive_path, std::string negative_path,
+                 std::vector<std::string> &paths, unsigned int &positive_count);
 
+private:
+  unsigned int threads;
 };
 
 #endif // EVALUATOR_H
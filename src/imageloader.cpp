@@ -0,0 +1,165 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: imageloader.cpp
+ */
+
+#include "imageloader.h"
+
+#include <fstream>
+#include <algorithm>
+
+ImageLoader::ImageLoader(const std::vector<std::string> &paths,
+                         unsigned int threads, unsigned int capacity)
+  : paths(paths), images(paths.size()), loaded(paths.size(), false),
+    capacity(std::max(1u, capacity)), next_image(0), pending(0), stop(false)
+{
+  threads = std::min<std::size_t>(std::max(1u, threads), paths.size());
+
+  if (threads == 0) {
+    return;
+  }
+
+  // One thread submitting batches of reads replaces mapping threads
+  reader = std::make_shared<BatchReader>();
+
+  if (reader->ready()) {
+    loaders.push_back(std::thread(&ImageLoader::readBatches, this));
+    return;
+  }
+
+  reader.reset();
+
+  for (unsigned int i = 0; i < threads; i++) {
+    loaders.push_back(std::thread(&ImageLoader::work, this));
+  }
+}
+
+ImageLoader::~ImageLoader()
+{
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    stop = true;
+  }
+  space_available.notify_all();
+
+  for (unsigned int i = 0; i < loaders.size(); i++) {
+    loaders.at(i).join();
+  }
+}
+
+std::shared_ptr<MappedBitmap> ImageLoader::get(unsigned int index)
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (!loaded.at(index)) {
+    image_loaded.wait(guard);
+  }
+
+  std::shared_ptr<MappedBitmap> image = images.at(index);
+  images.at(index).reset();
+
+  pending--;
+  space_available.notify_one();
+
+  return image;
+}
+
+bool ImageLoader::readList(std::string path, std::vector<std::string> &paths)
+{
+  std::ifstream input(path.c_str());
+  std::string image_path;
+
+  if (!input.is_open()) {
+    return false;
+  }
+
+  while (std::getline(input, image_path)) {
+    paths.push_back(image_path);
+  }
+  return true;
+}
+
+void ImageLoader::work()
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (true) {
+    while (!stop && next_image < paths.size() && pending >= capacity) {
+      space_available.wait(guard);
+    }
+
+    if (stop || next_image >= paths.size()) {
+      return;
+    }
+
+    const unsigned int index = next_image++;
+    pending++;
+
+    // Map image and read its pages without holding lock
+    guard.unlock();
+
+    std::shared_ptr<MappedBitmap> image = std::make_shared<MappedBitmap>(paths.at(index));
+
+    if (!!*image) {
+      image->prefetch();
+    }
+
+    guard.lock();
+    store(index, image);
+  }
+}
+
+void ImageLoader::readBatches()
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  const BatchReader::done_t done = [this](unsigned int index, std::vector<unsigned char> &data) {
+    std::shared_ptr<MappedBitmap> image = std::make_shared<MappedBitmap>();
+    image->assign(data);
+
+    std::unique_lock<std::mutex> guard(lock);
+    store(index, image);
+  };
+
+  while (true) {
+    // Queue reads while there is space in window and in reader
+    while (!stop && next_image < paths.size() && pending < capacity && !reader->full()) {
+      const unsigned int index = next_image++;
+      pending++;
+
+      guard.unlock();
+      bool queued = reader->queue(index, paths.at(index));
+      guard.lock();
+
+      if (!queued) {
+        store(index, std::make_shared<MappedBitmap>());
+      }
+    }
+
+    if (stop || (next_image >= paths.size() && reader->pending() == 0)) {
+      return;
+    }
+
+    // Nothing to wait for, window is full of images not taken yet
+    if (reader->pending() == 0) {
+      space_available.wait(guard);
+      continue;
+    }
+
+    guard.unlock();
+    reader->complete(done);
+    guard.lock();
+  }
+}
+
+void ImageLoader::store(unsigned int index, const std::shared_ptr<MappedBitmap> &image)
+{
+  images.at(index) = image;
+  loaded.at(index) = true;
+  image_loaded.notify_all();
+}
@@ -0,0 +1,87 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: imageloader.h
+ */
+
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "mappedbitmap.h"
+#include "batchreader.h"
+
+// Default number of loading threads and of images loaded ahead
+#define IMAGE_LOADER_THREADS  4
+#define IMAGE_LOADER_CAPACITY 64
+
+// Asynchronous loading of images listed in text file. Images are read
+// in order of the list, at most capacity images ahead of consumers.
+// If io_uring is available, one loader thread keeps many reads in flight
+// (BatchReader), otherwise loader threads map images and read their pages.
+// Consumers (histogram or predict workers) get images by their index, so
+// I/O of next images overlaps with computation. Each image has to be
+// taken exactly once.
+//
+class ImageLoader
+{
+public:
+  ImageLoader(const std::vector<std::string> &paths,
+              unsigned int threads = IMAGE_LOADER_THREADS,
+              unsigned int capacity = IMAGE_LOADER_CAPACITY);
+  ~ImageLoader();
+
+  // Wait for image with given index and take it from loader
+  // (returned image is empty if it could not be loaded)
+  std::shared_ptr<MappedBitmap> get(unsigned int index);
+
+  // Get path of image with given index
+  const std::string & path(unsigned int index) const { return paths.at(index); }
+
+  // Get number of images
+  unsigned int size() const { return paths.size(); }
+
+  // Read image paths from text file (one path per line)
+  static bool readList(std::string path, std::vector<std::string> &paths);
+
+protected:
+  // Map images until all are loaded or loader is destroyed
+  void work();
+
+  // Read images by batches on io_uring until all are loaded
+  // or loader is destroyed
+  void readBatches();
+
+  // Store loaded image and wake up consumers (lock is held)
+  void store(unsigned int index, const std::shared_ptr<MappedBitmap> &image);
+
+private:
+  std::vector<std::string> paths;
+  std::vector<std::shared_ptr<MappedBitmap> > images;
+  std::vector<char> loaded;
+
+  std::vector<std::thread> loaders;
+  std::shared_ptr<BatchReader> reader;
+
+  std::mutex lock;
+  std::condition_variable image_loaded;
+  std::condition_variable space_available;
+
+  unsigned int capacity;
+  unsigned int next_image;
+  unsigned int pending;
+
+  bool stop;
+};
+
+#endif // IMAGELOADER_H
@@ -0,0 +1,66 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: imageview.h
+ */
+
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+#include "bitmap_image.hpp"
+
+#define CHANNELS_BGR 0
+#define CHANNELS_RGB 1
+
+// Non-owning view of 24-bit image data. The view only refers to pixels
+// stored elsewhere (bitmap_image, memory mapped file, network buffer),
+// so it is cheap to copy and pass by value. Rows are separated by stride
+// bytes, which may be negative for bottom-up stored images.
+//
+class ImageView
+{
+public:
+  ImageView()
+    : data(0), width(0), height(0), stride(0), channels(CHANNELS_BGR) {}
+
+  ImageView(const unsigned char *data, unsigned int width, unsigned int height,
+            long stride, int channels = CHANNELS_BGR)
+    : data(data), width(width), height(height), stride(stride), channels(channels) {}
+
+  // View pixels of loaded bitmap (stored in BGR order)
+  ImageView(const bitmap_image &image)
+    : data(image.row(0)), width(image.width()), height(image.height()),
+      stride((long)image.width() * image.bytes_per_pixel()), channels(CHANNELS_BGR) {}
+
+  // Get pointer to first pixel of row y
+  const unsigned char * row(unsigned int y) const {
+    return data + (long)y * stride;
+  }
+
+  // Byte offsets of color components within pixel
+  unsigned int redOffset() const  { return (channels == CHANNELS_BGR) ? 2 : 0; }
+  unsigned int blueOffset() const { return (channels == CHANNELS_BGR) ? 0 : 2; }
+
+  // Get color components of pixel at position (x, y)
+  void getPixel(unsigned int x, unsigned int y,
+                unsigned char &r, unsigned char &g, unsigned char &b) const {
+    const unsigned char *pixel = row(y) + 3 * x;
+    r = pixel[redOffset()];
+    g = pixel[1];
+    b = pixel[blueOffset()];
+  }
+
+  bool empty() const { return data == 0 || width == 0 || height == 0; }
+
+  const unsigned char *data;
+  unsigned int width;
+  unsigned int height;
+  long stride;
+  int channels;
+};
+
+#endif // IMAGEVIEW_H
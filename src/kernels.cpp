@@ -0,0 +1,775 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: kernels.cpp
+ */
+
+#include <cstring>
+
+#include "kernels.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Spread 8 bits of value to every third bit (bit i moves to bit 3i)
+static inline unsigned int spreadBits(unsigned int v)
+{
+  v = (v | (v << 8)) & 0x0000f00f;
+  v = (v | (v << 4)) & 0x000c30c3;
+  v = (v | (v << 2)) & 0x00249249;
+  return v;
+}
+
+// Gather every third bit of value (inverse of spreadBits)
+static inline unsigned int compactBits(unsigned int v)
+{
+  v &= 0x00249249;
+  v = (v | (v >> 2)) & 0x000c30c3;
+  v = (v | (v >> 4)) & 0x0000f00f;
+  v = (v | (v >> 8)) & 0x000000ff;
+  return v;
+}
+
+unsigned int mortonBin(unsigned int r, unsigned int g, unsigned int b)
+{
+  return spreadBits(r) | (spreadBits(g) << 1) | (spreadBits(b) << 2);
+}
+
+void mortonColor(unsigned int bin, unsigned int &r, unsigned int &g, unsigned int &b)
+{
+  r = compactBits(bin);
+  g = compactBits(bin >> 1);
+  b = compactBits(bin >> 2);
+}
+
+// Compute bin index of one pixel
+template <unsigned int dim, unsigned int shift, bool morton>
+static inline unsigned int pixelBin(const unsigned char *pixel, unsigned int red, unsigned int blue)
+{
+  unsigned int bin = pixel[red] >> shift;
+
+  if (dim == 3 && morton) {
+    bin = mortonBin(bin, pixel[1] >> shift, pixel[blue] >> shift);
+  } else if (dim == 3) {
+    const unsigned int bits = 8 - shift;
+    bin |= ((pixel[1] >> shift) << bits) | ((pixel[blue] >> shift) << (2 * bits));
+  }
+  return bin;
+}
+
+#if defined(__AVX2__)
+// Byte shuffle moving 4 pixels of 128-bit lane into 32-bit words
+// holding red, green and blue in the lowest three bytes
+static inline __m256i pixelShuffle(unsigned int red)
+{
+  if (red == 2) {
+    return _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                            2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  }
+  return _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                          0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+}
+
+// Spread bits of 8-bit values in 32-bit words (see spreadBits)
+static inline __m256i spreadBits(__m256i v)
+{
+  v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_set1_epi32(0x0000f00f));
+  v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)), _mm256_set1_epi32(0x000c30c3));
+  v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)), _mm256_set1_epi32(0x00249249));
+  return v;
+}
+
+// Convert 32-bit words with red, green and blue bytes to bin indices
+template <unsigned int dim, unsigned int shift, bool morton>
+static inline __m256i binIndex(__m256i rgb)
+{
+  const __m256i byte = _mm256_set1_epi32(0xff);
+
+  __m256i bin = _mm256_srli_epi32(_mm256_and_si256(rgb, byte), shift);
+
+  if (dim == 3) {
+    const unsigned int bits = 8 - shift;
+
+    __m256i g = _mm256_srli_epi32(_mm256_and_si256(_mm256_srli_epi32(rgb, 8), byte), shift);
+    __m256i b = _mm256_srli_epi32(_mm256_srli_epi32(rgb, 16), shift);
+
+    if (morton) {
+      bin = _mm256_or_si256(spreadBits(bin), _mm256_slli_epi32(spreadBits(g), 1));
+      bin = _mm256_or_si256(bin, _mm256_slli_epi32(spreadBits(b), 2));
+    } else {
+      bin = _mm256_or_si256(bin, _mm256_slli_epi32(g, bits));
+      bin = _mm256_or_si256(bin, _mm256_slli_epi32(b, 2 * bits));
+    }
+  }
+  return bin;
+}
+#endif
+
+#if defined(__AVX512BW__)
+static inline __m512i spreadBits(__m512i v)
+{
+  v = _mm512_and_si512(_mm512_or_si512(v, _mm512_slli_epi32(v, 8)), _mm512_set1_epi32(0x0000f00f));
+  v = _mm512_and_si512(_mm512_or_si512(v, _mm512_slli_epi32(v, 4)), _mm512_set1_epi32(0x000c30c3));
+  v = _mm512_and_si512(_mm512_or_si512(v, _mm512_slli_epi32(v, 2)), _mm512_set1_epi32(0x00249249));
+  return v;
+}
+
+template <unsigned int dim, unsigned int shift, bool morton>
+static inline __m512i binIndex(__m512i rgb)
+{
+  const __m512i byte = _mm512_set1_epi32(0xff);
+
+  __m512i bin = _mm512_srli_epi32(_mm512_and_si512(rgb, byte), shift);
+
+  if (dim == 3) {
+    const unsigned int bits = 8 - shift;
+
+    __m512i g = _mm512_srli_epi32(_mm512_and_si512(_mm512_srli_epi32(rgb, 8), byte), shift);
+    __m512i b = _mm512_srli_epi32(_mm512_srli_epi32(rgb, 16), shift);
+
+    if (morton) {
+      bin = _mm512_or_si512(spreadBits(bin), _mm512_slli_epi32(spreadBits(g), 1));
+      bin = _mm512_or_si512(bin, _mm512_slli_epi32(spreadBits(b), 2));
+    } else {
+      bin = _mm512_or_si512(bin, _mm512_slli_epi32(g, bits));
+      bin = _mm512_or_si512(bin, _mm512_slli_epi32(b, 2 * bits));
+    }
+  }
+  return bin;
+}
+#endif
+
+// Bin kernel specialized for method (dim), quantization (shift) and
+// layout of bins, shifts are immediate and tests of dim and layout
+// are resolved at compile time
+template <unsigned int dim, unsigned int shift, bool morton>
+static void computeBins(const unsigned char *row, unsigned int count, unsigned int step,
+                        unsigned int red, unsigned int blue, unsigned int *bins)
+{
+  unsigned int x = 0;
+
+#if defined(__AVX2__)
+  // Vectorized code handles contiguous pixels only
+  if (step == 1) {
+    const __m256i shuffle = pixelShuffle(red);
+
+#if defined(__AVX512BW__)
+    // 16 pixels per iteration, 64 loaded bytes are spread into
+    // four 128-bit lanes with 4 pixels (12 bytes) each
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6, 6, 7, 8, 9, 9, 10, 11, 12);
+    const __m512i shuffle512 = _mm512_broadcast_i64x4(shuffle);
+
+    for (; x + 22 <= count; x += 16) {
+      __m512i data = _mm512_loadu_si512((const void *)(row + 3 * x));
+      __m512i rgb = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(lanes, data), shuffle512);
+      _mm512_storeu_si512((void *)(bins + x), binIndex<dim, shift, morton>(rgb));
+    }
+#endif
+
+    // 8 pixels per iteration, each 128-bit lane gets 4 pixels (12 bytes)
+    for (; x + 10 <= count; x += 8) {
+      __m256i data = _mm256_loadu2_m128i((const __m128i *)(row + 3 * x + 12),
+                                         (const __m128i *)(row + 3 * x));
+      __m256i rgb = _mm256_shuffle_epi8(data, shuffle);
+      _mm256_storeu_si256((__m256i *)(bins + x), binIndex<dim, shift, morton>(rgb));
+    }
+  }
+#endif
+
+  if (step == 1) {
+    for (; x < count; x++) {
+      bins[x] = pixelBin<dim, shift, morton>(row + 3 * x, red, blue);
+    }
+  } else {
+    for (; x < count; x++) {
+      bins[x] = pixelBin<dim, shift, morton>(row + 3 * x * step, red, blue);
+    }
+  }
+}
+
+// Instantiations for shift 0 .. 8 of one method and layout
+#define BIN_KERNELS(dim, morton) \
+  { computeBins<dim, 0, morton>, computeBins<dim, 1, morton>, computeBins<dim, 2, morton>, \
+    computeBins<dim, 3, morton>, computeBins<dim, 4, morton>, computeBins<dim, 5, morton>, \
+    computeBins<dim, 6, morton>, computeBins<dim, 7, morton>, computeBins<dim, 8, morton> }
+
+bin_kernel_t binKernel(unsigned int shift, unsigned int dim, bool morton)
+{
+  // Bins of one component are in the same order in both layouts
+  static const bin_kernel_t kernels[3][9] = { BIN_KERNELS(1, false), BIN_KERNELS(3, false),
+                                              BIN_KERNELS(3, true) };
+
+  if (shift > 8 || (dim != 1 && dim != 3)) {
+    return 0;
+  }
+  return kernels[(dim == 3) ? ((morton) ? 2 : 1) : 0][shift];
+}
+
+#if defined(__AVX2__)
+// Count bins of small histogram, bin indices are packed to bytes
+// (in different order, which does not change counts) and each bin
+// counts bytes equal to its index
+static unsigned int countSmallBins(const unsigned int *bins, unsigned int count,
+                                   unsigned int *histogram, unsigned int size)
+{
+  unsigned int x = 0;
+
+#if defined(__AVX512BW__)
+  for (; x + 64 <= count; x += 64) {
+    __m512i b0 = _mm512_loadu_si512((const void *)(bins + x));
+    __m512i b1 = _mm512_loadu_si512((const void *)(bins + x + 16));
+    __m512i b2 = _mm512_loadu_si512((const void *)(bins + x + 32));
+    __m512i b3 = _mm512_loadu_si512((const void *)(bins + x + 48));
+    __m512i v = _mm512_packus_epi16(_mm512_packus_epi32(b0, b1), _mm512_packus_epi32(b2, b3));
+
+    for (unsigned int b = 0; b < size; b++) {
+      histogram[b] += __builtin_popcountll(_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(b)));
+    }
+  }
+#endif
+
+  for (; x + 32 <= count; x += 32) {
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(bins + x));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(bins + x + 8));
+    __m256i b2 = _mm256_loadu_si256((const __m256i *)(bins + x + 16));
+    __m256i b3 = _mm256_loadu_si256((const __m256i *)(bins + x + 24));
+    __m256i v = _mm256_packus_epi16(_mm256_packus_epi32(b0, b1), _mm256_packus_epi32(b2, b3));
+
+    for (unsigned int b = 0; b < size; b++) {
+      histogram[b] += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(b))));
+    }
+  }
+
+  return x;
+}
+#endif
+
+void countBins(const unsigned int *bins, unsigned int count,
+               unsigned int *histograms, std::size_t size, unsigned int copies)
+{
+  unsigned int x = 0;
+
+#if defined(__AVX2__)
+  if (size <= REGISTER_COUNT_BINS) {
+    x = countSmallBins(bins, count, histograms, size);
+  }
+#endif
+
+  if (copies == HISTOGRAM_COPIES) {
+    unsigned int *h0 = histograms;
+    unsigned int *h1 = histograms + size;
+    unsigned int *h2 = histograms + 2 * size;
+    unsigned int *h3 = histograms + 3 * size;
+
+    for (; x + 4 <= count; x += 4) {
+      h0[bins[x + 0]]++;
+      h1[bins[x + 1]]++;
+      h2[bins[x + 2]]++;
+      h3[bins[x + 3]]++;
+    }
+  }
+
+  for (; x < count; x++) {
+    histograms[bins[x]]++;
+  }
+}
+
+#if defined(__AVX2__)
+// Sum lanes of vector
+static inline double reduceAdd(__m256d acc)
+{
+  __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+#endif
+
+#if defined(__AVX512F__)
+// Look up 8 values of table of 8 * regs doubles held in registers,
+// bit 4 of index selects pair of registers
+template <unsigned int regs>
+static inline __m512d lookupTable(const __m512d *t, __m256i bins)
+{
+  const __m512i i = _mm512_cvtepu32_epi64(bins);
+
+  if (regs == 1) {
+    return _mm512_permutexvar_pd(i, t[0]);
+  }
+
+  __m512d v = _mm512_permutex2var_pd(t[0], i, t[1]);
+
+  if (regs == 4) {
+    v = _mm512_mask_blend_pd(_mm512_test_epi64_mask(i, _mm512_set1_epi64(16)), v,
+                             _mm512_permutex2var_pd(t[2], i, t[3]));
+  }
+  return v;
+}
+
+// Look up 16 values of table of 16 * regs floats held in registers
+template <unsigned int regs>
+static inline __m512 lookupTable(const __m512 *t, __m512i i)
+{
+  if (regs == 1) {
+    return _mm512_permutexvar_ps(i, t[0]);
+  }
+
+  __m512 v = _mm512_permutex2var_ps(t[0], i, t[1]);
+
+  if (regs == 4) {
+    v = _mm512_mask_blend_ps(_mm512_test_epi32_mask(i, _mm512_set1_epi32(32)), v,
+                             _mm512_permutex2var_ps(t[2], i, t[3]));
+  }
+  return v;
+}
+
+// Accumulate values of table in registers into the same lanes
+// as gathers of sumBins(), so the sum is the same
+template <unsigned int regs>
+static unsigned int sumTable(const unsigned int *bins, unsigned int count, const __m512d *t,
+                             __m512d &acc0, __m512d &acc1)
+{
+  unsigned int x = 0;
+
+  for (; x + 16 <= count; x += 16) {
+    __m256i i0 = _mm256_loadu_si256((const __m256i *)(bins + x));
+    __m256i i1 = _mm256_loadu_si256((const __m256i *)(bins + x + 8));
+    acc0 = _mm512_add_pd(acc0, lookupTable<regs>(t, i0));
+    acc1 = _mm512_add_pd(acc1, lookupTable<regs>(t, i1));
+  }
+  return x;
+}
+
+template <unsigned int regs>
+static unsigned int sumTable(const unsigned int *bins, unsigned int count, const __m512 *t,
+                             __m512d &acc0, __m512d &acc1)
+{
+  unsigned int x = 0;
+
+  for (; x + 16 <= count; x += 16) {
+    __m512 v = lookupTable<regs>(t, _mm512_loadu_si512((const void *)(bins + x)));
+    __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+    acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+    acc1 = _mm512_add_pd(acc1, _mm512_cvtps_pd(high));
+  }
+  return x;
+}
+
+// Load small table into registers (zero padded)
+// and sum its values at bins, returns number of summed bins
+static unsigned int sumRegisterTable(const unsigned int *bins, unsigned int count,
+                                     const double *table, std::size_t size,
+                                     __m512d &acc0, __m512d &acc1)
+{
+  alignas(64) double local[REGISTER_TABLE_BINS / 2] = {0};
+  __m512d t[REGISTER_TABLE_BINS / 16];
+
+  memcpy(local, table, size * sizeof(double));
+
+  for (unsigned int r = 0; r < REGISTER_TABLE_BINS / 16; r++) {
+    t[r] = _mm512_load_pd(local + 8 * r);
+  }
+
+  if (size <= 8) {
+    return sumTable<1>(bins, count, t, acc0, acc1);
+  } else if (size <= 16) {
+    return sumTable<2>(bins, count, t, acc0, acc1);
+  }
+  return sumTable<4>(bins, count, t, acc0, acc1);
+}
+
+static unsigned int sumRegisterTable(const unsigned int *bins, unsigned int count,
+                                     const float *table, std::size_t size,
+                                     __m512d &acc0, __m512d &acc1)
+{
+  alignas(64) float local[REGISTER_TABLE_BINS] = {0};
+  __m512 t[REGISTER_TABLE_BINS / 16];
+
+  memcpy(local, table, size * sizeof(float));
+
+  for (unsigned int r = 0; r < REGISTER_TABLE_BINS / 16; r++) {
+    t[r] = _mm512_load_ps(local + 16 * r);
+  }
+
+  if (size <= 16) {
+    return sumTable<1>(bins, count, t, acc0, acc1);
+  } else if (size <= 32) {
+    return sumTable<2>(bins, count, t, acc0, acc1);
+  }
+  return sumTable<4>(bins, count, t, acc0, acc1);
+}
+#endif
+
+#if defined(__AVX512VBMI__)
+// Sum fixed point values of small table held in registers. Table is
+// split to byte planes (plane p holds byte p of values), so values
+// are looked up in low bytes of bin indices by vpermb (64 entries)
+// and summed by vpsadbw, sum of plane p is weighted by 2^(8p)
+template <typename T>
+static unsigned long long sumRegisterFixed(const unsigned int *bins, unsigned int count,
+                                           const T *table, std::size_t size, unsigned int &x)
+{
+  alignas(64) unsigned char planes[sizeof(T)][REGISTER_TABLE_BINS];
+  __m512i t[sizeof(T)], acc[sizeof(T)];
+
+  memset(planes, 0, sizeof(planes));
+
+  for (unsigned int p = 0; p < sizeof(T); p++) {
+    for (std::size_t n = 0; n < size; n++) {
+      planes[p][n] = (table[n] >> (8 * p)) & 0xff;
+    }
+    t[p] = _mm512_load_si512((const void *)planes[p]);
+    acc[p] = _mm512_setzero_si512();
+  }
+
+  const __m512i low = _mm512_set1_epi32(0xff);
+  const __m512i zero = _mm512_setzero_si512();
+
+  for (; x + 16 <= count; x += 16) {
+    __m512i i = _mm512_loadu_si512((const void *)(bins + x));
+
+    for (unsigned int p = 0; p < sizeof(T); p++) {
+      __m512i v = _mm512_and_si512(_mm512_permutexvar_epi8(i, t[p]), low);
+      acc[p] = _mm512_add_epi64(acc[p], _mm512_sad_epu8(v, zero));
+    }
+  }
+
+  unsigned long long sum = 0;
+
+  for (unsigned int p = 0; p < sizeof(T); p++) {
+    sum += (unsigned long long)_mm512_reduce_add_epi64(acc[p]) << (8 * p);
+  }
+  return sum;
+}
+#elif defined(__AVX2__)
+// Look up bytes of table of 16 * quarters entries held in registers,
+// pshufb looks up 16 entries, bits 4 and 5 of index select quarter
+// (shifted to bit 7 of index byte for blend)
+template <unsigned int quarters>
+static inline __m256i lookupBytes(const __m256i *t, __m256i i)
+{
+  __m256i v = _mm256_shuffle_epi8(t[0], i);
+
+  if (quarters >= 2) {
+    const __m256i bit4 = _mm256_slli_epi32(i, 3);
+    v = _mm256_blendv_epi8(v, _mm256_shuffle_epi8(t[1], i), bit4);
+
+    if (quarters == 4) {
+      __m256i w = _mm256_blendv_epi8(_mm256_shuffle_epi8(t[2], i), _mm256_shuffle_epi8(t[3], i), bit4);
+      v = _mm256_blendv_epi8(v, w, _mm256_slli_epi32(i, 2));
+    }
+  }
+  return v;
+}
+
+template <unsigned int planes, unsigned int quarters>
+static void sumBytes(const unsigned int *bins, unsigned int count, const __m256i (*t)[4],
+                     __m256i *acc, unsigned int &x)
+{
+  const __m256i low = _mm256_set1_epi32(0xff);
+  const __m256i zero = _mm256_setzero_si256();
+
+  for (; x + 8 <= count; x += 8) {
+    __m256i i = _mm256_loadu_si256((const __m256i *)(bins + x));
+
+    for (unsigned int p = 0; p < planes; p++) {
+      __m256i v = _mm256_and_si256(lookupBytes<quarters>(t[p], i), low);
+      acc[p] = _mm256_add_epi64(acc[p], _mm256_sad_epu8(v, zero));
+    }
+  }
+}
+
+// Sum fixed point values of small table held in registers, table is
+// split to byte planes (see above) and values are looked up by pshufb
+template <typename T>
+static unsigned long long sumRegisterFixed(const unsigned int *bins, unsigned int count,
+                                           const T *table, std::size_t size, unsigned int &x)
+{
+  alignas(32) unsigned char planes[sizeof(T)][REGISTER_TABLE_BINS];
+  __m256i t[sizeof(T)][4], acc[sizeof(T)];
+
+  memset(planes, 0, sizeof(planes));
+
+  for (unsigned int p = 0; p < sizeof(T); p++) {
+    for (std::size_t n = 0; n < size; n++) {
+      planes[p][n] = (table[n] >> (8 * p)) & 0xff;
+    }
+
+    for (unsigned int q = 0; q < 4; q++) {
+      t[p][q] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)(planes[p] + 16 * q)));
+    }
+    acc[p] = _mm256_setzero_si256();
+  }
+
+  if (size <= 16) {
+    sumBytes<sizeof(T), 1>(bins, count, t, acc, x);
+  } else if (size <= 32) {
+    sumBytes<sizeof(T), 2>(bins, count, t, acc, x);
+  } else {
+    sumBytes<sizeof(T), 4>(bins, count, t, acc, x);
+  }
+
+  unsigned long long sum = 0;
+
+  for (unsigned int p = 0; p < sizeof(T); p++) {
+    unsigned long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc[p]);
+    sum += ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) << (8 * p);
+  }
+  return sum;
+}
+#endif
+
+double sumBins(const unsigned int *bins, unsigned int count, const double *table, std::size_t size)
+{
+  unsigned int x = 0;
+  double sum = 0;
+
+#if defined(__AVX512F__)
+  // Gather 16 table values per iteration into two accumulators
+  // (values of small table are looked up in registers)
+  __m512d acc0 = _mm512_setzero_pd();
+  __m512d acc1 = _mm512_setzero_pd();
+
+  if (size <= REGISTER_TABLE_BINS / 2) {
+    x = sumRegisterTable(bins, count, table, size, acc0, acc1);
+  }
+
+  for (; x + 16 <= count; x += 16) {
+    __m256i i0 = _mm256_loadu_si256((const __m256i *)(bins + x));
+    __m256i i1 = _mm256_loadu_si256((const __m256i *)(bins + x + 8));
+    acc0 = _mm512_add_pd(acc0, _mm512_i32gather_pd(i0, table, 8));
+    acc1 = _mm512_add_pd(acc1, _mm512_i32gather_pd(i1, table, 8));
+  }
+  sum += _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+#elif defined(__AVX2__)
+  // Gather 8 table values per iteration into two accumulators
+  // (tables are held in registers only by AVX-512)
+  (void)size;
+
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+
+  for (; x + 8 <= count; x += 8) {
+    __m128i i0 = _mm_loadu_si128((const __m128i *)(bins + x));
+    __m128i i1 = _mm_loadu_si128((const __m128i *)(bins + x + 4));
+    acc0 = _mm256_add_pd(acc0, _mm256_i32gather_pd(table, i0, 8));
+    acc1 = _mm256_add_pd(acc1, _mm256_i32gather_pd(table, i1, 8));
+  }
+  sum += reduceAdd(_mm256_add_pd(acc0, acc1));
+#else
+  // Independent partial sums hide latency of table loads
+  (void)size;
+
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+  for (; x + 4 <= count; x += 4) {
+    s0 += table[bins[x + 0]];
+    s1 += table[bins[x + 1]];
+    s2 += table[bins[x + 2]];
+    s3 += table[bins[x + 3]];
+  }
+  sum += (s0 + s1) + (s2 + s3);
+#endif
+
+  for (; x < count; x++) {
+    sum += table[bins[x]];
+  }
+  return sum;
+}
+
+double sumBins(const unsigned int *bins, unsigned int count, const float *table, std::size_t size)
+{
+  unsigned int x = 0;
+  double sum = 0;
+
+#if defined(__AVX512F__)
+  // Gather 16 table values per iteration, halves are widened to doubles
+  // (values of small table are looked up in registers)
+  __m512d acc0 = _mm512_setzero_pd();
+  __m512d acc1 = _mm512_setzero_pd();
+
+  if (size <= REGISTER_TABLE_BINS) {
+    x = sumRegisterTable(bins, count, table, size, acc0, acc1);
+  }
+
+  for (; x + 16 <= count; x += 16) {
+    __m512i i = _mm512_loadu_si512((const void *)(bins + x));
+    __m512 v = _mm512_i32gather_ps(i, table, 4);
+    __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+    acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+    acc1 = _mm512_add_pd(acc1, _mm512_cvtps_pd(high));
+  }
+  sum += _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+#elif defined(__AVX2__)
+  // Gather 8 table values per iteration, halves are widened to doubles
+  // (tables are held in registers only by AVX-512)
+  (void)size;
+
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+
+  for (; x + 8 <= count; x += 8) {
+    __m256i i = _mm256_loadu_si256((const __m256i *)(bins + x));
+    __m256 v = _mm256_i32gather_ps(table, i, 4);
+    acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+    acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+  }
+  sum += reduceAdd(_mm256_add_pd(acc0, acc1));
+#else
+  (void)size;
+
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+  for (; x + 4 <= count; x += 4) {
+    s0 += table[bins[x + 0]];
+    s1 += table[bins[x + 1]];
+    s2 += table[bins[x + 2]];
+    s3 += table[bins[x + 3]];
+  }
+  sum += (s0 + s1) + (s2 + s3);
+#endif
+
+  for (; x < count; x++) {
+    sum += table[bins[x]];
+  }
+  return sum;
+}
+
+// Sum fixed point values, vector code gathers 32-bit words at element
+// addresses and keeps the low bytes (table is followed by padding)
+template <typename T>
+static unsigned long long sumFixed(const unsigned int *bins, unsigned int count, const T *table, std::size_t size)
+{
+  unsigned long long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  unsigned int x = 0;
+
+#if defined(__AVX2__)
+  // Small table is held in registers
+  if (size <= REGISTER_TABLE_BINS) {
+    s0 += sumRegisterFixed(bins, count, table, size, x);
+  }
+#else
+  (void)size;
+#endif
+
+#if defined(__AVX512F__)
+  const __m512i mask = _mm512_set1_epi32((1u << (8 * sizeof(T))) - 1);
+
+  // Sums are moved from 32-bit lanes to 64-bit sums by blocks,
+  // lanes hold sums of at most 2^15 + 1 values of 16 bits
+  while (x + 16 <= count) {
+    const unsigned int end = (count - x > (1u << 20)) ? x + (1u << 20) : count;
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+
+    for (; x + 32 <= end; x += 32) {
+      __m512i i0 = _mm512_loadu_si512((const void *)(bins + x));
+      __m512i i1 = _mm512_loadu_si512((const void *)(bins + x + 16));
+      acc0 = _mm512_add_epi32(acc0, _mm512_and_si512(_mm512_i32gather_epi32(i0, (const void *)table, sizeof(T)), mask));
+      acc1 = _mm512_add_epi32(acc1, _mm512_and_si512(_mm512_i32gather_epi32(i1, (const void *)table, sizeof(T)), mask));
+    }
+
+    for (; x + 16 <= end; x += 16) {
+      __m512i i0 = _mm512_loadu_si512((const void *)(bins + x));
+      acc0 = _mm512_add_epi32(acc0, _mm512_and_si512(_mm512_i32gather_epi32(i0, (const void *)table, sizeof(T)), mask));
+    }
+
+    s0 += _mm512_reduce_add_epi64(_mm512_cvtepu32_epi64(_mm512_castsi512_si256(acc0)));
+    s1 += _mm512_reduce_add_epi64(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(acc0, 1)));
+    s2 += _mm512_reduce_add_epi64(_mm512_cvtepu32_epi64(_mm512_castsi512_si256(acc1)));
+    s3 += _mm512_reduce_add_epi64(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(acc1, 1)));
+  }
+#elif defined(__AVX2__)
+  const __m256i mask = _mm256_set1_epi32((1u << (8 * sizeof(T))) - 1);
+
+  // Sums are moved from 32-bit lanes to 64-bit sums by blocks,
+  // lanes hold sums of at most 2^15 + 1 values of 16 bits
+  while (x + 8 <= count) {
+    const unsigned int end = (count - x > (1u << 19)) ? x + (1u << 19) : count;
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    for (; x + 16 <= end; x += 16) {
+      __m256i i0 = _mm256_loadu_si256((const __m256i *)(bins + x));
+      __m256i i1 = _mm256_loadu_si256((const __m256i *)(bins + x + 8));
+      acc0 = _mm256_add_epi32(acc0, _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, i0, sizeof(T)), mask));
+      acc1 = _mm256_add_epi32(acc1, _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, i1, sizeof(T)), mask));
+    }
+
+    for (; x + 8 <= end; x += 8) {
+      __m256i i0 = _mm256_loadu_si256((const __m256i *)(bins + x));
+      acc0 = _mm256_add_epi32(acc0, _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, i0, sizeof(T)), mask));
+    }
+
+    __m256i wide = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(acc0)),
+                                    _mm256_cvtepu32_epi64(_mm256_extracti128_si256(acc0, 1)));
+    wide = _mm256_add_epi64(wide, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(acc1)));
+    wide = _mm256_add_epi64(wide, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(acc1, 1)));
+
+    unsigned long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, wide);
+    s0 += lanes[0];
+    s1 += lanes[1];
+    s2 += lanes[2];
+    s3 += lanes[3];
+  }
+#endif
+
+  for (; x + 4 <= count; x += 4) {
+    s0 += table[bins[x + 0]];
+    s1 += table[bins[x + 1]];
+    s2 += table[bins[x + 2]];
+    s3 += table[bins[x + 3]];
+  }
+
+  for (; x < count; x++) {
+    s0 += table[bins[x]];
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+
+unsigned long long sumBins(const unsigned int *bins, unsigned int count, const uint16_t *table, std::size_t size)
+{
+  return sumFixed(bins, count, table, size);
+}
+
+unsigned long long sumBins(const unsigned int *bins, unsigned int count, const uint8_t *table, std::size_t size)
+{
+  return sumFixed(bins, count, table, size);
+}
+
+void resolveBins(unsigned int *bins, unsigned int count,
+                 const unsigned int *index, unsigned int bits)
+{
+  const unsigned int mask = (1u << bits) - 1;
+  unsigned int x = 0;
+
+#if defined(__AVX512F__)
+  // Gather block offsets of 16 bins per iteration
+  const __m512i vmask = _mm512_set1_epi32(mask);
+
+  for (; x + 16 <= count; x += 16) {
+    __m512i b = _mm512_loadu_si512((const void *)(bins + x));
+    __m512i offset = _mm512_i32gather_epi32(_mm512_srli_epi32(b, bits), (const void *)index, 4);
+    _mm512_storeu_si512((void *)(bins + x), _mm512_add_epi32(offset, _mm512_and_si512(b, vmask)));
+  }
+#elif defined(__AVX2__)
+  // Gather block offsets of 8 bins per iteration
+  const __m256i vmask = _mm256_set1_epi32(mask);
+  const __m128i vbits = _mm_cvtsi32_si128(bits);
+
+  for (; x + 8 <= count; x += 8) {
+    __m256i b = _mm256_loadu_si256((const __m256i *)(bins + x));
+    __m256i offset = _mm256_i32gather_epi32((const int *)index, _mm256_srl_epi32(b, vbits), 4);
+    _mm256_storeu_si256((__m256i *)(bins + x), _mm256_add_epi32(offset, _mm256_and_si256(b, vmask)));
+  }
+#endif
+
+  for (; x < count; x++) {
+    bins[x] = index[bins[x] >> bits] + (bins[x] & mask);
+  }
+}
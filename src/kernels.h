@@ -0,0 +1,97 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: kernels.h
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <stdint.h>
+
+// Number of private sub-histograms used to count pixels of one image
+#define HISTOGRAM_COPIES 4
+
+// Largest histogram counted into sub-histograms, bigger histograms
+// are incremented directly (sub-histograms would not fit in cache)
+#define HISTOGRAM_COPIES_MAX_BINS 65536
+
+// Number of bytes which must follow fixed point table of sumBins()
+#define FIXED_TABLE_PADDING 4
+
+// Largest table held in vector registers, its values are looked up
+// by permutes or byte shuffles instead of loads (tables of doubles
+// up to half of the size, more doubles need more permutes than loads)
+#define REGISTER_TABLE_BINS 64
+
+// Largest histogram counted by byte compares (one compare per bin
+// for each vector of bin indices)
+#define REGISTER_COUNT_BINS 32
+
+// Row kernels operating on interleaved 24-bit pixels. The vectorized
+// variants are selected at compile time (AVX-512BW, AVX2), otherwise
+// portable scalar code is used. Quantization is power of 2, so colors
+// are quantized using shifts instead of divisions.
+
+// Compute histogram bin index of every step-th pixel in row
+//  row   - pointer to first pixel of row
+//  count - number of pixels to process
+//  step  - distance of processed pixels (subsampling)
+//  red, blue - byte offset of red and blue component in pixel
+//  bins  - output array of count bin indices
+typedef void (*bin_kernel_t)(const unsigned char *row, unsigned int count, unsigned int step,
+                             unsigned int red, unsigned int blue, unsigned int *bins);
+
+// Get bin kernel compiled for given quantization and method, so inner
+// loops have no runtime parameters (returns null for unsupported values)
+//  shift  - log2 of quantization (0 .. 8)
+//  dim    - 1 to use only red component, 3 to use RGB
+//  morton - RGB bins in Morton order (see mortonBin)
+bin_kernel_t binKernel(unsigned int shift, unsigned int dim, bool morton = false);
+
+// Get Morton (Z-order) index of quantized color, bits of components
+// are interleaved (red in lowest bit), so similar colors are close
+// in table in all three dimensions, not only in red
+unsigned int mortonBin(unsigned int r, unsigned int g, unsigned int b);
+
+// Get quantized color of Morton index
+void mortonColor(unsigned int bin, unsigned int &r, unsigned int &g, unsigned int &b);
+
+// Count bin indices into sub-histograms (consecutive indices go to
+// different copies, so repeated bins do not wait on previous stores)
+//  histograms - copies arrays of size elements each
+//  copies     - number of sub-histograms, HISTOGRAM_COPIES or 1
+// (histograms of at most REGISTER_COUNT_BINS bins are counted
+// by compares of vector registers into the first copy)
+void countBins(const unsigned int *bins, unsigned int count,
+               unsigned int *histograms, std::size_t size, unsigned int copies);
+
+// Sum table values at bin indices, ie posterior probabilities of pixels
+// (vector lanes are summed separately, so the result may differ from
+// sequential sum by rounding, relative error at most count * 2^-53)
+//  size - number of table elements, small tables (REGISTER_TABLE_BINS)
+//         are held in registers (the sum does not depend on it)
+double sumBins(const unsigned int *bins, unsigned int count, const double *table, std::size_t size);
+
+// Sum float table values at bin indices (values are summed as doubles)
+double sumBins(const unsigned int *bins, unsigned int count, const float *table, std::size_t size);
+
+// Sum fixed point table values at bin indices, the sum is exact
+// (vector code reads 32-bit words, so the table must be followed
+// by FIXED_TABLE_PADDING readable bytes)
+unsigned long long sumBins(const unsigned int *bins, unsigned int count, const uint16_t *table, std::size_t size);
+unsigned long long sumBins(const unsigned int *bins, unsigned int count, const uint8_t *table, std::size_t size);
+
+// Replace bin indices by offsets into storage of sparse table
+// (see SparseTable), so values are summed by sumBins()
+//  index - block index of sparse table
+//  bits  - log2 of number of elements in block
+void resolveBins(unsigned int *bins, unsigned int count,
+                 const unsigned int *index, unsigned int bits);
+
+#endif // KERNELS_H
@@ -9,16 +9,28 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <sstream>
+#include <deque>
+#include <algorithm>
+#include <cstdlib>
 
 #include "bayesclassifier.h"
 #include "evaluator.h"
+#include "roccurve.h"
+#include "server.h"
 
 #define VARIANT_ERR   -1
 #define VARIANT_EVAL   1
 #define VARIANT_TEST   2
 #define VARIANT_THRESH 3
+#define VARIANT_MODEL  4
+#define VARIANT_SERVE  5
+#define VARIANT_MERGE  6
+
+// Number of images loaded and predicted at once (--images)
+#define PREDICT_BATCH 1024
 
 // Command line arguments
 typedef struct params {
@@ -27,26 +39,52 @@ typedef struct params {
 
   std::string train_positive;
   std::string train_negative;
-  std::string test_positive;
-  std::string test_negative;
+  std::vector<test_set_t> test_sets;
+  std::string update_positive;
+  std::string update_negative;
   std::string test_image;
+  std::string test_images;
+  std::string save_model;
+  std::string load_model;
+  std::string socket_path;
+  std::vector<std::string> merge_models;
+
+  unsigned int shard_index;
+  unsigned int shard_count;
 
   int quantization;
   int method;
   bool subsampling;
+  int layout;
+  int precision;
+
+  // All requested quantizations and methods (--evaluate),
+  // model is trained with the finest one
+  std::vector<int> quantizations;
+  std::vector<int> methods;
   double threshold;
+  unsigned int threads;
 
   params() {
     variant = VARIANT_ERR;
     quantization = 16;
     method = BAYESIAN_RGB;
     subsampling = false;
+    layout = LAYOUT_LINEAR;
+    precision = -1;
     threshold = -1;
+    threads = 0;
+    shard_index = 0;
+    shard_count = 1;
   }
 } params_t;
 
 params_t parseArguments(int argc, char **argv);
 void printUsage();
+bool predictImages(const BayesClassifier &bayes, std::string list);
+bool prepareModel(const params_t &p, BayesClassifier &bayes);
+bool evaluateModel(const params_t &p, Evaluator &eval, const BayesClassifier &bayes);
+void printCurveSummary(const RocCurve &roc);
 
 
 int main(int argc, char **argv)
@@ -76,27 +114,18 @@ int main(int argc, char **argv)
       return 1;
     }
 
-    std::cout << "threshold" << "\t" << "FP/(TP+FP)" << "\t" << "TP/(TP+FN)" << std::endl;
-    for (double threshold = 0; threshold <= 1.0; threshold += 0.01) {
-      int TP = 0, FP = 0;
-      int TN = 0, FN = 0;
+    // Rates at every distinct probability of training samples
+    RocCurve roc(training);
+    const std::vector<roc_point_t> &points = roc.points();
 
-      // Calculate true and false classification rates
-      for (unsigned int i = 0; i < training.size(); i++) {
-        double prob   = training.at(i).probability;
-        bool positive = training.at(i).positive;
-
-        if ( positive && prob >  threshold) { TP++; }
-        if (!positive && prob <= threshold) { TN++; }
-        if ( positive && prob <= threshold) { FN++; }
-        if (!positive && prob >  threshold) { FP++; }
-      }
-
-      int N = TN + FP;
-      int P = TP + FN;
-      std::cout << threshold << "\t" << (double)FP / N
-                << "\t" << (double)TP / P << std::endl;
+    std::cout << "threshold" << "\t" << "FP/(FP+TN)" << "\t" << "TP/(TP+FN)"
+              << "\t" << "TP/(TP+FP)" << std::endl;
+    for (unsigned int i = 0; i < points.size(); i++) {
+      std::cout << points.at(i).threshold << "\t" << points.at(i).fpr
+                << "\t" << points.at(i).tpr << "\t" << points.at(i).precision << std::endl;
     }
+
+    printCurveSummary(roc);
   }
 
   // Evaluate method using training and test dataset
@@ -108,21 +137,40 @@ int main(int argc, char **argv)
       return 1;
     }
 
-    BayesClassifier bayes(p.quantization, p.method, p.subsampling);
-    Evaluator eval;
+    BayesClassifier bayes(p.quantization, p.method, p.subsampling, p.layout);
+    bayes.setThreads(p.threads);
+    bayes.setShard(p.shard_index, p.shard_count);
+    Evaluator eval(p.threads);
 
-    if (!bayes.train(p.train_positive, p.train_negative)) {
-      std::cout << p.train_positive << " " << p.train_negative << std::endl;
-      std::cerr << "Failed to open training text file." << std::endl;
+    if (!prepareModel(p, bayes)) {
       return 1;
     }
 
-    // Evaluate Bayes classifier using positive and negative image from test dataset
-    double precision, recall;
-    eval.evaluate(bayes, p.test_positive, p.test_negative, p.threshold, precision, recall);
+    if (p.methods.size() == 1 && p.quantizations.size() == 1) {
+      return evaluateModel(p, eval, bayes) ? 0 : 1;
+    }
+
+    for (unsigned int m = 0; m < p.methods.size(); m++) {
+      for (unsigned int q = 0; q < p.quantizations.size(); q++) {
+        const char *method = (p.methods.at(m) == BAYESIAN_RGB) ? "BAYESIAN_RGB" : "BAYESIAN_R";
+
+        // Other models are derived from trained model without training
+        BayesClassifier model(p.quantizations.at(q), p.methods.at(m), p.subsampling, p.layout);
+        model.setPrecision(bayes.getPrecision());
+
+        if (!bayes.derive(model)) {
+          std::cerr << "Model " << method << " q=" << p.quantizations.at(q)
+                    << " cannot be derived from loaded model." << std::endl;
+          return 1;
+        }
 
-    printf("Precision %.2f %% \n", precision * 100.0);
-    printf("Recall %.2f %% \n", recall * 100.0);
+        printf("Model %s q=%d\n", method, p.quantizations.at(q));
+
+        if (!evaluateModel(p, eval, model)) {
+          return 1;
+        }
+      }
+    }
 
     //printf("Elapsed training time %.3f ms\n", train_time);
     //printf("Elapsed test time %.3f ms\n", test_time);
@@ -131,19 +179,25 @@ int main(int argc, char **argv)
   // Calculate probability of sample (that it belongs to positive class)
   else if (p.variant == VARIANT_TEST) {
 
-    if (p.test_image.empty()) {
-      std::cerr << "Input image not found (use parameter --image)." << std::endl;
+    if (p.test_image.empty() && p.test_images.empty()) {
+      std::cerr << "Input image not found (use parameter --image or --images)." << std::endl;
       return 1;
     }
 
-    BayesClassifier bayes(p.quantization, p.method, p.subsampling);
+    BayesClassifier bayes(p.quantization, p.method, p.subsampling, p.layout);
+    bayes.setThreads(p.threads);
+    bayes.setShard(p.shard_index, p.shard_count);
 
-    if (!bayes.train(p.train_positive, p.train_negative)) {
-      std::cerr << "Failed to open training text file." << std::endl;
+    if (!prepareModel(p, bayes)) {
       return 1;
     }
 
-    bitmap_image image(p.test_image);
+    // Compute probabilities for all images in list
+    if (!p.test_images.empty()) {
+      return predictImages(bayes, p.test_images) ? 0 : 1;
+    }
+
+    MappedBitmap image(p.test_image);
 
     if (!image) {
       std::cerr << "Image " << p.test_image << " not found" << std::endl;
@@ -151,28 +205,221 @@ int main(int argc, char **argv)
     }
 
     // Compute probability for input sample
-    double probability = bayes.predict(image);
+    double probability = bayes.predict(image.view());
     printf("Posterior probability of sample: %.2f %% \n", probability * 100);
   }
 
+  // Answer prediction requests on Unix domain socket
+  else if (p.variant == VARIANT_SERVE) {
+
+    BayesClassifier bayes(p.quantization, p.method, p.subsampling, p.layout);
+    bayes.setThreads(p.threads);
+    bayes.setShard(p.shard_index, p.shard_count);
+
+    if (!prepareModel(p, bayes)) {
+      return 1;
+    }
+
+    Server server(bayes, p.threads);
+
+    if (!server.run(p.socket_path)) {
+      return 1;
+    }
+  }
+
+  // Sum models trained on shards of training data
+  else if (p.variant == VARIANT_MERGE) {
+
+    if (p.merge_models.size() < 2) {
+      std::cerr << "Use --merge output.bin input1.bin input2.bin ..." << std::endl;
+      return 1;
+    }
+
+    BayesClassifier bayes(p.quantization, p.method, p.subsampling, p.layout);
+
+    if (!bayes.load(p.merge_models.at(1))) {
+      return 1;
+    }
+
+    for (unsigned int i = 2; i < p.merge_models.size(); i++) {
+      BayesClassifier shard(p.quantization, p.method, p.subsampling, p.layout);
+
+      if (!shard.load(p.merge_models.at(i))) {
+        return 1;
+      }
+
+      if (!bayes.merge(shard)) {
+        std::cerr << "Model " << p.merge_models.at(i) << " has different parameters." << std::endl;
+        return 1;
+      }
+    }
+
+    if (!bayes.save(p.merge_models.at(0))) {
+      std::cerr << "Failed to save model " << p.merge_models.at(0) << "." << std::endl;
+      return 1;
+    }
+  }
+
+  // Train model and save it (--save-model)
+  else if (p.variant == VARIANT_MODEL) {
+
+    BayesClassifier bayes(p.quantization, p.method, p.subsampling, p.layout);
+    bayes.setThreads(p.threads);
+    bayes.setShard(p.shard_index, p.shard_count);
+
+    if (!prepareModel(p, bayes)) {
+      return 1;
+    }
+  }
+
   return 0;
 }
 
+// Load model (--load-model) or train it using training samples,
+// add new samples (--update) and save it if required (--save-model)
+bool prepareModel(const params_t &p, BayesClassifier &bayes)
+{
+  if (!p.load_model.empty() && !bayes.load(p.load_model)) {
+    return false;
+  }
+
+  // Posterior of loaded model keeps its format unless it is given
+  if (p.precision >= 0) {
+    bayes.setPrecision(p.precision);
+  }
+
+  if (p.load_model.empty() && !bayes.train(p.train_positive, p.train_negative)) {
+    std::cerr << "Failed to open training text file." << std::endl;
+    return false;
+  }
+
+  // Add new samples to loaded or trained model
+  if (!p.update_positive.empty() && !bayes.update(p.update_positive, p.update_negative)) {
+    std::cerr << "Failed to open text file with new samples." << std::endl;
+    return false;
+  }
+
+  bayes.refresh();
+
+  if (!p.save_model.empty() && !bayes.save(p.save_model)) {
+    std::cerr << "Failed to save model " << p.save_model << "." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Evaluate model on all test datasets and print results
+bool evaluateModel(const params_t &p, Evaluator &eval, const BayesClassifier &bayes)
+{
+  // Evaluate Bayes classifier using positive and negative images
+  // of all test datasets
+  std::vector<confusion_t> results;
+  std::vector<std::vector<training_sample_t> > scores;
+
+  if (!eval.evaluate(bayes, p.test_sets, p.threshold, results, &scores)) {
+    return false;
+  }
+
+  for (unsigned int n = 0; n < results.size(); n++) {
+    const confusion_t &r = results.at(n);
+
+    if (results.size() > 1) {
+      printf("Test set %s %s\n", p.test_sets.at(n).positive.c_str(), p.test_sets.at(n).negative.c_str());
+    }
+
+    printf("Precision %.2f %% \n", (double)r.TP / (r.TP + r.FN) * 100.0);
+    printf("Recall %.2f %% \n", (double)r.TP / (r.TP + r.FP) * 100.0);
+
+    if (!scores.at(n).empty()) {
+      printCurveSummary(RocCurve(scores.at(n)));
+    }
+  }
+
+  return true;
+}
+
+// Print area under ROC and PR curve and thresholds maximizing F1 and Youden's J
+void printCurveSummary(const RocCurve &roc)
+{
+  const roc_point_t &f1 = roc.bestF1();
+  const roc_point_t &youden = roc.bestYouden();
+
+  printf("ROC AUC %.4f \n", roc.auc());
+  printf("Average precision %.4f \n", roc.averagePrecision());
+  printf("Best F1 %.4f at threshold %g \n", RocCurve::f1(f1), f1.threshold);
+  printf("Best Youden J %.4f at threshold %g \n", RocCurve::youden(youden), youden.threshold);
+}
+
+// Predict images listed in text file in batches and print their probabilities
+bool predictImages(const BayesClassifier &bayes, std::string list)
+{
+  std::ifstream input(list.c_str());
+  std::string image_path;
+
+  if (!input.is_open()) {
+    std::cerr << "Failed to open file " << list << "." << std::endl;
+    return false;
+  }
+
+  bool end = false;
+
+  while (!end) {
+    std::deque<MappedBitmap> images;
+    std::vector<std::string> paths;
+    std::vector<ImageView> samples;
+
+    // Load next batch of images
+    while (samples.size() < PREDICT_BATCH && !(end = !std::getline(input, image_path))) {
+      images.emplace_back(image_path);
+
+      if (!images.back()) {
+        std::cerr << "Image " << image_path << " not found" << std::endl;
+        images.pop_back();
+        continue;
+      }
+
+      paths.push_back(image_path);
+      samples.push_back(images.back().view());
+    }
+
+    // Compute probabilities for batch of samples
+    std::vector<double> probability = bayes.predict(samples);
+
+    for (unsigned int i = 0; i < paths.size(); i++) {
+      printf("%s\t%.2f %% \n", paths.at(i).c_str(), probability.at(i) * 100);
+    }
+  }
+
+  return true;
+}
+
 // Print help
 void printUsage()
 {
   std::cout << "Usage: ./bayes variant input ..." << std::endl
     << "  variant --evaluate: evaluation of implemented method" << std::endl
-    << "  variant --analyze:  show table of rates for training samples" << std::endl
+    << "  variant --analyze:  show ROC/PR table of rates for training samples" << std::endl
     << "  variant --test:     predict probability for sample" << std::endl
+    << "  variant --serve path: answer prediction requests on Unix socket" << std::endl
+    << "  variant --merge out in1 in2 ...: sum models trained on shards" << std::endl
+    << "  (no variant) --save-model path: train model and save it" << std::endl
     << "Required arguments:" << std::endl
-    << "  evaluate: --test pos neg, --train pos neg, --threshold num" << std::endl
+    << "  evaluate: --test pos neg (repeat for more test sets), --train pos neg, --threshold num" << std::endl
     << "  analyze:  --train pos neg" << std::endl
-    << "  test:     --train pos neg, --image path" << std::endl
+    << "  test:     --train pos neg, --image path or --images list" << std::endl
     << "Optional arguments:" << std::endl
     << "  --method BAYESIAN_R or --method BAYESIAN_RGB (default)" << std::endl
     << "  --q num: change size of histogram dimensions (default 16)" << std::endl
+    << "  --q and --method of evaluate take lists, eg --q 4,8,16 --method RGB,R" << std::endl
+    << "  --layout linear or --layout morton: order of RGB histogram bins (default linear)" << std::endl
+    << "  --precision double, float, u16 or u8: format of posterior table (default double)" << std::endl
     << "  --subsample: subsample images to descrease exec time (default not use)" << std::endl
+    << "  --save-model path: save trained model to binary file" << std::endl
+    << "  --load-model path: load model instead of training (evaluate, test)" << std::endl
+    << "  --update pos neg: add new samples to loaded or trained model" << std::endl
+    << "  --shard i/n: use only every n-th training image starting at i-th" << std::endl
+    << "  --threads num: number of training, prediction and evaluation threads (default number of CPU cores)" << std::endl
     << "Example:" << std::endl
     << "  image_operations.exe --evaluate --threshold 0.37 --subsample" << std::endl
     << "  image_operations.exe --evaluate --train p1.txt n1.txt --test p2.txt n2.txt --threshold 0.34" << std::endl
@@ -198,20 +445,59 @@ params_t parseArguments(int argc, char **argv)
     } else if (arg.compare("--predict") == 0) {
       p.variant = VARIANT_TEST;
 
+    } else if (arg.compare("--serve") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      p.variant = VARIANT_SERVE;
+      p.socket_path = std::string(argv[++i]);
+
+    } else if (arg.compare("--merge") == 0) {
+      p.variant = VARIANT_MERGE;
+      while (i+1 < argc && std::string(argv[i+1]).compare(0, 2, "--") != 0) {
+        p.merge_models.push_back(std::string(argv[++i]));
+      }
+
+    } else if (arg.compare("--shard") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      std::istringstream s(argv[++i]);
+      char separator = 0;
+      s >> p.shard_index >> separator >> p.shard_count;
+      if (separator != '/' || p.shard_count == 0 || p.shard_index >= p.shard_count) {
+        p.variant = VARIANT_ERR;
+        break;
+      }
+
     } else if (arg.compare("--train") == 0) {
       if (argc <= i+2) { p.variant = VARIANT_ERR; break; }
       p.train_positive = std::string(argv[++i]);
       p.train_negative = std::string(argv[++i]);
 
+    } else if (arg.compare("--update") == 0) {
+      if (argc <= i+2) { p.variant = VARIANT_ERR; break; }
+      p.update_positive = std::string(argv[++i]);
+      p.update_negative = std::string(argv[++i]);
+
     } else if (arg.compare("--test") == 0) {
       if (argc <= i+2) { p.variant = VARIANT_ERR; break; }
-      p.test_positive = std::string(argv[++i]);
-      p.test_negative = std::string(argv[++i]);
+      p.test_sets.push_back(test_set(argv[i+1], argv[i+2]));
+      i += 2;
 
     } else if (arg.compare("--image") == 0) {
       if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
       p.test_image = std::string(argv[++i]);
 
+    } else if (arg.compare("--images") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      p.test_images = std::string(argv[++i]);
+
+    } else if (arg.compare("--save-model") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      p.save_model = std::string(argv[++i]);
+      if (p.variant == VARIANT_ERR) { p.variant = VARIANT_MODEL; }
+
+    } else if (arg.compare("--load-model") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      p.load_model = std::string(argv[++i]);
+
     } else if (arg.compare("--threshold") == 0) {
       if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
       std::istringstream s(argv[++i]);
@@ -220,20 +506,62 @@ params_t parseArguments(int argc, char **argv)
     } else if (arg.compare("--q") == 0) {
       if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
       std::istringstream s(argv[++i]);
-      s >> p.quantization;
+      std::string q;
+      p.quantizations.clear();
+      while (std::getline(s, q, ',')) {
+        p.quantizations.push_back(atoi(q.c_str()));
+      }
 
     } else if (arg.compare("--method") == 0) {
       if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
-      std::string m(argv[++i]);
-      if (m.compare("rgb") || m.compare("RGB")) {
-        p.method = BAYESIAN_RGB;
-      } else if (m.compare("r") || m.compare("R")) {
-        p.method = BAYESIAN_R;
+      std::istringstream s(argv[++i]);
+      std::string m;
+      p.methods.clear();
+      while (std::getline(s, m, ',')) {
+        if (m == "BAYESIAN_RGB" || m == "RGB" || m == "rgb") {
+          p.methods.push_back(BAYESIAN_RGB);
+        } else if (m == "BAYESIAN_R" || m == "R" || m == "r") {
+          p.methods.push_back(BAYESIAN_R);
+        } else {
+          p.methods.clear();
+          break;
+        }
+      }
+      if (p.methods.empty()) { p.variant = VARIANT_ERR; break; }
+
+    } else if (arg.compare("--layout") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      std::string layout(argv[++i]);
+      if (layout == "linear") {
+        p.layout = LAYOUT_LINEAR;
+      } else if (layout == "morton") {
+        p.layout = LAYOUT_MORTON;
       } else {
         p.variant = VARIANT_ERR;
         break;
       }
 
+    } else if (arg.compare("--precision") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      std::string precision(argv[++i]);
+      if (precision == "double") {
+        p.precision = POSTERIOR_DOUBLE;
+      } else if (precision == "float") {
+        p.precision = POSTERIOR_FLOAT;
+      } else if (precision == "u16") {
+        p.precision = POSTERIOR_U16;
+      } else if (precision == "u8") {
+        p.precision = POSTERIOR_U8;
+      } else {
+        p.variant = VARIANT_ERR;
+        break;
+      }
+
+    } else if (arg.compare("--threads") == 0) {
+      if (argc <= i+1) { p.variant = VARIANT_ERR; break; }
+      std::istringstream s(argv[++i]);
+      s >> p.threads;
+
     } else if (arg.compare("--subsample") == 0) {
         p.subsampling = true;
 
@@ -243,16 +571,33 @@ params_t parseArguments(int argc, char **argv)
     }
   }
 
-  if (p.quantization > 256 || p.quantization <= 0 || (p.quantization & (p.quantization - 1)) != 0) {
-    std::cerr << "Quantization value must be power of 2 and lower than 256." << std::endl;
+  if (p.quantizations.empty()) {p.quantizations.push_back(p.quantization);}
+  if (p.methods.empty()) {p.methods.push_back(p.method);}
+
+  // Model is trained with finest quantization (and RGB if requested),
+  // other models are derived from it
+  p.quantization = *std::min_element(p.quantizations.begin(), p.quantizations.end());
+  p.method = *std::max_element(p.methods.begin(), p.methods.end());
+
+  for (unsigned int i = 0; i < p.quantizations.size(); i++) {
+    const int q = p.quantizations.at(i);
+
+    if (q > 256 || q <= 0 || (q & (q - 1)) != 0) {
+      std::cerr << "Quantization value must be power of 2 and lower than 256." << std::endl;
+      p.variant = VARIANT_ERR;
+      return p;
+    }
+  }
+
+  if ((p.quantizations.size() > 1 || p.methods.size() > 1) && p.variant != VARIANT_EVAL) {
+    std::cerr << "More quantizations or methods can be used only with --evaluate." << std::endl;
     p.variant = VARIANT_ERR;
     return p;
   }
 
   if (p.train_positive.empty()) {p.train_positive = "../data/train_pos.txt";}
   if (p.train_negative.empty()) {p.train_negative = "../data/train_neg.txt";}
-  if (p.test_positive.empty())  {p.test_positive = "../data/test_pos.txt";}
-  if (p.test_negative.empty())  {p.test_negative = "../data/test_neg.txt";}
+  if (p.test_sets.empty()) {p.test_sets.push_back(test_set("../data/test_pos.txt", "../data/test_neg.txt"));}
 
   return p;
 }
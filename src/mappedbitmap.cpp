@@ -0,0 +1,97 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: mappedbitmap.cpp
+ */
+
+#include "mappedbitmap.h"
+
+#include <stdint.h>
+
+// Read little-endian value from BMP header
+template <typename T>
+static T readValue(const unsigned char *data)
+{
+  T value = 0;
+
+  for (unsigned int i = 0; i < sizeof(T); i++) {
+    value |= (T)data[i] << (8 * i);
+  }
+  return value;
+}
+
+MappedBitmap::MappedBitmap()
+{
+}
+
+MappedBitmap::MappedBitmap(std::string path)
+{
+  open(path);
+}
+
+bool MappedBitmap::open(std::string path)
+{
+  pixels = ImageView();
+  std::vector<unsigned char>().swap(buffer);
+
+  if (!file.open(path)) {
+    return false;
+  }
+
+  if (!parse(file.data(), file.size(), pixels)) {
+    file.close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedBitmap::assign(std::vector<unsigned char> &data)
+{
+  pixels = ImageView();
+  file.close();
+  buffer.swap(data);
+
+  if (buffer.empty() || !parse(&buffer[0], buffer.size(), pixels)) {
+    std::vector<unsigned char>().swap(buffer);
+    return false;
+  }
+  return true;
+}
+
+bool MappedBitmap::parse(const unsigned char *data, std::size_t size, ImageView &view)
+{
+  // File header (14 bytes) and information header (at least 40 bytes)
+  if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+    return false;
+  }
+
+  const uint32_t offset      = readValue<uint32_t>(data + 10);
+  const int32_t  width       = readValue<uint32_t>(data + 18);
+  const int32_t  height      = readValue<uint32_t>(data + 22);
+  const uint16_t bit_count   = readValue<uint16_t>(data + 28);
+  const uint32_t compression = readValue<uint32_t>(data + 30);
+
+  if (bit_count != 24 || compression != 0 || width <= 0 || height == 0) {
+    return false;
+  }
+
+  // Rows are padded to multiple of 4 bytes
+  const uint64_t rows = (height > 0) ? height : -(int64_t)height;
+  const uint64_t row_size = (3 * (uint64_t)width + 3) & ~(uint64_t)3;
+
+  if (offset + rows * row_size > size) {
+    return false;
+  }
+
+  // Rows are stored bottom-up unless height is negative
+  if (height > 0) {
+    view = ImageView(data + offset + (rows - 1) * row_size, width, rows, -(long)row_size);
+  } else {
+    view = ImageView(data + offset, width, rows, (long)row_size);
+  }
+  return true;
+}
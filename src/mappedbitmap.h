@@ -0,0 +1,56 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: mappedbitmap.h
+ */
+
+#ifndef MAPPEDBITMAP_H
+#define MAPPEDBITMAP_H
+
+#include <string>
+#include <vector>
+
+#include "imageview.h"
+#include "mappedfile.h"
+
+// 24-bit BMP image used directly in memory mapped file (or in buffer
+// with file content). Pixels are not copied nor flipped, bottom-up images
+// are viewed with negative stride.
+//
+class MappedBitmap
+{
+public:
+  MappedBitmap();
+  MappedBitmap(std::string path);
+
+  // Map BMP file and check its format
+  bool open(std::string path);
+
+  // Use BMP file already read into memory, data are taken over
+  bool assign(std::vector<unsigned char> &data);
+
+  // Get view of pixels (valid while this object exists)
+  const ImageView & view() const { return pixels; }
+
+  bool operator!() const { return pixels.empty(); }
+
+  // Read image data into memory ahead of use
+  void prefetch() const { file.prefetch(); }
+
+  // Find pixels of uncompressed 24-bit BMP image stored in memory
+  static bool parse(const unsigned char *data, std::size_t size, ImageView &view);
+
+private:
+  MappedBitmap(const MappedBitmap &);
+  MappedBitmap & operator=(const MappedBitmap &);
+
+  MappedFile file;
+  std::vector<unsigned char> buffer;
+  ImageView pixels;
+};
+
+#endif // MAPPEDBITMAP_H
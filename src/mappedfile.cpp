@@ -0,0 +1,83 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: mappedfile.cpp
+ */
+
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile()
+{
+  address = 0;
+  length = 0;
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(std::string path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat info;
+
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *mapping = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  address = (const unsigned char *)mapping;
+  length = info.st_size;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (address != 0) {
+    munmap((void *)address, length);
+  }
+
+  address = 0;
+  length = 0;
+}
+
+void MappedFile::prefetch() const
+{
+  if (address == 0) {
+    return;
+  }
+
+  madvise((void *)address, length, MADV_WILLNEED);
+
+  // Touch each page, so it is loaded before the data are used
+  const std::size_t page = sysconf(_SC_PAGESIZE);
+  volatile unsigned char sum = 0;
+
+  for (std::size_t i = 0; i < length; i += page) {
+    sum += address[i];
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: mappedfile.h
+ */
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of whole file. Pages are loaded by the
+// operating system on first access (or shared from page cache), so
+// data are used in place without reading and parsing the file.
+//
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+
+  // Map file into memory, previous mapping is released
+  bool open(std::string path);
+
+  // Release mapping
+  void close();
+
+  // Read all pages of mapped file into memory
+  void prefetch() const;
+
+  const unsigned char * data() const { return address; }
+  std::size_t size() const { return length; }
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile & operator=(const MappedFile &);
+
+  const unsigned char *address;
+  std::size_t length;
+};
+
+#endif // MAPPEDFILE_H
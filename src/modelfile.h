@@ -0,0 +1,63 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: modelfile.h
+ */
+
+#ifndef MODELFILE_H
+#define MODELFILE_H
+
+#include <stdint.h>
+
+#define MODEL_MAGIC   "BAYESMDL"
+#define MODEL_VERSION 4
+
+// Header of binary model file. The header is followed by tables of
+// bins elements at given offsets (aligned to 64 bytes):
+//  positive and negative histogram (uint64_t pixel counts)
+//  posterior probability P(w|x) of each bin (double, float, uint16_t
+//  or uint8_t by posterior format)
+// Values are stored in native byte order, so the file is used
+// in place after mapping it into memory. Tables are ordered by layout
+// of bins (version 1 files have no layout and use linear order,
+// posterior of version 1 and 2 files is double).
+//
+// Tables of sparse models (version 4, stored is not zero) keep only
+// blocks of SPARSE_BLOCK_BITS bins with samples. Block index at
+// index_offset holds offset of each block in the tables (uint32_t per
+// block, in elements), blocks without samples are at offset 0, where
+// each table starts with a zero block. Each table has stored elements.
+//
+typedef struct model_header {
+
+  char magic[8];
+  uint32_t version;
+
+  uint32_t method;
+  uint32_t quantization;
+  uint32_t subsample;
+
+  double prior;
+
+  uint64_t number_of_samples;
+  uint64_t positive_samples;
+  uint64_t negative_samples;
+
+  uint64_t bins;
+  uint64_t positive_offset;
+  uint64_t negative_offset;
+  uint64_t posterior_offset;
+
+  uint32_t layout;
+  uint32_t posterior_format;
+
+  uint64_t index_offset;
+  uint64_t stored;
+
+} model_header_t;
+
+#endif // MODELFILE_H
@@ -12,99 +12,211 @@
 #define NVECTOR_H
 
 #include <vector>
-#include <math.h>
+#include <limits>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
 #include <assert.h>
 
 #define NORM_SUM 1
 #define NORM_MAX 2
 
+// Alignment of vector storage (cache line)
+#define NVECTOR_ALIGNMENT 64
+
 #ifndef NDEBUG
   #define NDEBUG
 #endif
 
+// Allocator of cache-line aligned memory, so vector storage starts
+// at cache line boundary (aligned SIMD loads, no split lines).
+//
+template <typename T>
+class aligned_allocator {
+public:
+  typedef T value_type;
+
+  aligned_allocator() {}
+
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U> &) {}
+
+  T * allocate(std::size_t n) {
+    void *p = 0;
+
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T) ||
+        posix_memalign(&p, NVECTOR_ALIGNMENT, (n > 0) ? n * sizeof(T) : 1) != 0) {
+      throw std::bad_alloc();
+    }
+    return (T *)p;
+  }
+
+  void deallocate(T *p, std::size_t) {
+    free(p);
+  }
+
+  template <typename U>
+  struct rebind { typedef aligned_allocator<U> other; };
+
+  template <typename U>
+  bool operator==(const aligned_allocator<U> &) const { return true; }
+
+  template <typename U>
+  bool operator!=(const aligned_allocator<U> &) const { return false; }
+};
+
+// Number of elements of dim-dimensional vector with d elements
+// in each dimension (d^dim, computed without floating point)
+template <unsigned int dim>
+inline std::size_t power(std::size_t d) {
+  return d * power<dim - 1>(d);
+}
+
+template <>
+inline std::size_t power<0>(std::size_t) {
+  return 1;
+}
+
 // This class represents vector in 1D, 2D or 3D space.
-// Elements are stored in std::vector of size d^1, d^2 or d^3.
+// Elements are stored in aligned contiguous memory of size d^1, d^2
+// or d^3, element (i, j, k) is at index i + j*d + k*d*d. Rank is
+// a template parameter, so strides of unused dimensions are resolved
+// at compile time. Reductions are unchecked and written for SIMD.
 //
 template <typename T, unsigned int dim>
 class vector {
 public:
+  typedef std::vector<T, aligned_allocator<T> > storage_t;
+
   vector(unsigned int d=0, T const & t=T()) :
-    d(d), data((int)std::pow((double)d, (int)dim), t) {}
+    d(d), data(power<dim>(d), t) {}
 
-  vector(const std::vector<T> t, unsigned int d) :
-    d(d), data(t) {}
+  vector(const std::vector<T> &t, unsigned int d) :
+    d(d), data(t.begin(), t.end()) {}
 
   // Access element
   // Returns a reference to the element at specific position
   T & operator()(unsigned int i, unsigned int j=0, unsigned int k=0) {
-    assert(i + j*d + k*d*d < std::pow((double)d, (int)dim));
-    assert(i < d && j < d && k < d);
-    return data[i + j*d + k*d*d];
+    assert(i < d && (dim > 1 || j == 0) && (dim > 2 || k == 0) && j < d && k < d);
+    return data[offset(i, j, k)];
   }
 
   // Access element at specific position
   T const & operator()(unsigned int i, unsigned int j=0, unsigned int k=0) const {
-    assert(i + j*d + k*d*d < std::pow((double)d, (int)dim));
-    assert(i < d && j < d && k < d);
-    return data[i + j*d + k*d*d];
+    assert(i < d && (dim > 1 || j == 0) && (dim > 2 || k == 0) && j < d && k < d);
+    return data[offset(i, j, k)];
+  }
+
+  // Access element using linear index into the underlying storage
+  T & operator[](std::size_t n) {
+    return data[n];
   }
 
-  // Assign new contents to the vector
-  vector<T, dim> & operator=(const vector<T, dim> & src) {
-    d = src.d;
-    data = src.data;
-    return *this;
+  T const & operator[](std::size_t n) const {
+    return data[n];
   }
 
   // Insert element into specific position
   void assign(T const & t, unsigned int i, unsigned int j=0, unsigned int k=0) {
-    assert(i + j*d + k*d*d < std::pow((double)d, (int)dim));
-    assert(i < d && j < d && k < d);
-    data[i + j*d + k*d*d] = t;
+    (*this)(i, j, k) = t;
   }
 
   // Increment element on specific position
   void inc(unsigned int i, unsigned int j=0, unsigned int k=0) {
-    assert(i + j*d + k*d*d < std::pow((double)d, (int)dim));
-    assert(i < d && j < d && k < d);
-    data[i + j*d + k*d*d] += 1;
+    (*this)(i, j, k) += 1;
   }
 
-  // Get sum of elements in vector
-  double sum() {
-    double s = 0;
+  // Get sum of elements in vector (integer elements are summed exactly,
+  // floating point elements by independent partial sums)
+  double sum() const {
+    const T *p = ptr();
+    const std::size_t n = data.size();
+
+    typedef typename accumulator<std::numeric_limits<T>::is_integer>::type acc_t;
+    acc_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+      s0 += p[i + 0];
+      s1 += p[i + 1];
+      s2 += p[i + 2];
+      s3 += p[i + 3];
+    }
 
-    for (unsigned int i = 0; i < data.size(); i++) {
-      s += data.at(i);
+    for (; i < n; i++) {
+      s0 += p[i];
     }
-    return s;
+    return (double)((s0 + s1) + (s2 + s3));
   }
 
   // Get maximum value in vector
-  double max() {
-    return *std::max_element(data.begin(), data.end());
+  double max() const {
+    const T *p = ptr();
+    const std::size_t n = data.size();
+
+    if (n == 0) {
+      return 0;
+    }
+
+    T m0 = p[0], m1 = p[0], m2 = p[0], m3 = p[0];
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+      m0 = (p[i + 0] > m0) ? p[i + 0] : m0;
+      m1 = (p[i + 1] > m1) ? p[i + 1] : m1;
+      m2 = (p[i + 2] > m2) ? p[i + 2] : m2;
+      m3 = (p[i + 3] > m3) ? p[i + 3] : m3;
+    }
+
+    for (; i < n; i++) {
+      m0 = (p[i] > m0) ? p[i] : m0;
+    }
+
+    m0 = (m1 > m0) ? m1 : m0;
+    m2 = (m3 > m2) ? m3 : m2;
+    return (m2 > m0) ? m2 : m0;
   }
 
   // Normalize vector using sum of all elements (NORM_SUM)
   // or maximum value (NORM_MAX)
   void normalize(int method = NORM_SUM) {
-    double norm = (method == NORM_SUM) ? sum() : max();
+    const double norm = (method == NORM_SUM) ? sum() : max();
 
-    for (unsigned int i = 0; i < data.size(); i++) {
-      data.at(i) /= norm;
+    T *p = (data.empty()) ? 0 : &data[0];
+    const std::size_t n = data.size();
+
+    for (std::size_t i = 0; i < n; i++) {
+      p[i] /= norm;
     }
   }
 
-  std::size_t dimension() { return d; }
-  std::size_t size() { return data.size(); }
+  std::size_t dimension() const { return d; }
+  std::size_t size() const { return data.size(); }
 
-  std::vector<T> get() {
-    return data;
+  // Get pointer to contiguous storage of elements
+  const T * ptr() const {
+    return data.empty() ? 0 : &data[0];
   }
 
 private:
+  // Type of partial sums, integers are summed exactly
+  template <bool integer, int unused = 0>
+  struct accumulator { typedef double type; };
+
+  template <int unused>
+  struct accumulator<true, unused> { typedef unsigned long long type; };
+
+  // Linear index of element, unused dimensions are removed at compile time
+  std::size_t offset(unsigned int i, unsigned int j, unsigned int k) const {
+    std::size_t n = i;
+
+    if (dim > 1) { n += (std::size_t)j * d; }
+    if (dim > 2) { n += (std::size_t)k * d * d; }
+    return n;
+  }
+
   unsigned int d;
-  std::vector<T> data;
+  storage_t data;
 };
 
 typedef vector<unsigned long, 3> vector3UL;
@@ -0,0 +1,115 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: roccurve.cpp
+ */
+
+#include "roccurve.h"
+
+#include <algorithm>
+
+// Order samples by decreasing probability
+static bool higherProbability(const training_sample_t &a, const training_sample_t &b)
+{
+  return a.probability > b.probability;
+}
+
+RocCurve::RocCurve(const std::vector<training_sample_t> &samples)
+  : positive(0), negative(0)
+{
+  std::vector<training_sample_t> sorted(samples);
+  std::sort(sorted.begin(), sorted.end(), higherProbability);
+
+  for (unsigned int i = 0; i < sorted.size(); i++) {
+    if (sorted.at(i).positive) { positive++; } else { negative++; }
+  }
+
+  roc_point_t point;
+  std::size_t i = 0;
+
+  // Each distinct probability is threshold of one point, samples with
+  // equal probability move above threshold together
+  while (i < sorted.size()) {
+    point.threshold = sorted.at(i).probability;
+    point.tpr = (positive > 0) ? (double)point.TP / positive : 0;
+    point.fpr = (negative > 0) ? (double)point.FP / negative : 0;
+    point.precision = (point.TP + point.FP > 0) ? (double)point.TP / (point.TP + point.FP) : 1;
+    curve.push_back(point);
+
+    const double threshold = point.threshold;
+
+    for (; i < sorted.size() && sorted.at(i).probability == threshold; i++) {
+      if (sorted.at(i).positive) { point.TP++; } else { point.FP++; }
+    }
+  }
+}
+
+double RocCurve::auc() const
+{
+  if (curve.empty()) {
+    return 0;
+  }
+
+  // Trapezoidal rule, ties of positive and negative samples
+  // contribute by half
+  double area = 0;
+
+  for (unsigned int i = 1; i < curve.size(); i++) {
+    area += (curve.at(i).fpr - curve.at(i-1).fpr) * (curve.at(i).tpr + curve.at(i-1).tpr) / 2;
+  }
+  area += (1 - curve.back().fpr) * (1 + curve.back().tpr) / 2;
+
+  return area;
+}
+
+double RocCurve::averagePrecision() const
+{
+  if (curve.empty() || positive == 0) {
+    return 0;
+  }
+
+  // Sum of precisions weighted by increase of recall
+  double area = 0;
+
+  for (unsigned int i = 1; i < curve.size(); i++) {
+    area += (curve.at(i).tpr - curve.at(i-1).tpr) * curve.at(i).precision;
+  }
+  area += (1 - curve.back().tpr) * (double)positive / (positive + negative);
+
+  return area;
+}
+
+const roc_point_t & RocCurve::bestF1() const
+{
+  unsigned int best = 0;
+
+  for (unsigned int i = 1; i < curve.size(); i++) {
+    if (f1(curve.at(i)) > f1(curve.at(best))) { best = i; }
+  }
+  return curve.at(best);
+}
+
+const roc_point_t & RocCurve::bestYouden() const
+{
+  unsigned int best = 0;
+
+  for (unsigned int i = 1; i < curve.size(); i++) {
+    if (youden(curve.at(i)) > youden(curve.at(best))) { best = i; }
+  }
+  return curve.at(best);
+}
+
+double RocCurve::f1(const roc_point_t &point)
+{
+  const double sum = point.precision + point.tpr;
+  return (sum > 0) ? 2 * point.precision * point.tpr / sum : 0;
+}
+
+double RocCurve::youden(const roc_point_t &point)
+{
+  return point.tpr - point.fpr;
+}
@@ -0,0 +1,68 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: roccurve.h
+ */
+
+#ifndef ROCCURVE_H
+#define ROCCURVE_H
+
+#include <vector>
+#include "evaluator.h"
+
+// Classification rates of samples with probability above threshold
+typedef struct roc_point {
+
+  double threshold;
+
+  unsigned long TP;
+  unsigned long FP;
+
+  double tpr;        // TP/(TP+FN), ie recall
+  double fpr;        // FP/(FP+TN)
+  double precision;  // TP/(TP+FP), 1 if no sample is above threshold
+
+  roc_point()
+    : threshold(0), TP(0), FP(0), tpr(0), fpr(0), precision(1) {}
+
+} roc_point_t;
+
+// ROC and precision-recall curve of scored samples. Samples are sorted
+// once by probability and rates are computed in one pass at every
+// distinct probability, ie at exact resolution of scores. Points are
+// ordered by decreasing threshold, a sample is positive if its
+// probability is greater than threshold (same as evaluation).
+//
+class RocCurve
+{
+public:
+  RocCurve(const std::vector<training_sample_t> &samples);
+
+  // Get points of curve, first point has no positive sample
+  const std::vector<roc_point_t> & points() const { return curve; }
+
+  // Area under ROC curve (curve is closed by point 1, 1)
+  double auc() const;
+
+  // Area under precision-recall curve (average precision)
+  double averagePrecision() const;
+
+  // Get point with maximal F1 score and maximal Youden's J (tpr - fpr)
+  const roc_point_t & bestF1() const;
+  const roc_point_t & bestYouden() const;
+
+  static double f1(const roc_point_t &point);
+  static double youden(const roc_point_t &point);
+
+private:
+  std::vector<roc_point_t> curve;
+
+  unsigned long positive;
+  unsigned long negative;
+};
+
+#endif // ROCCURVE_H
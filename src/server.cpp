@@ -0,0 +1,272 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: server.cpp
+ */
+
+#include "server.h"
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <new>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+// Read exactly size bytes appended to data (or less if connection is
+// closed), data grows by chunks as the bytes are received
+static std::size_t readBytes(int fd, std::vector<char> &data, std::size_t size, std::vector<char> &buffer)
+{
+  // Use bytes already buffered after last line
+  std::size_t done = std::min(size, buffer.size());
+  data.insert(data.end(), buffer.begin(), buffer.begin() + done);
+  buffer.erase(buffer.begin(), buffer.begin() + done);
+
+  char chunk[SERVER_READ_CHUNK];
+
+  while (done < size) {
+    ssize_t n = recv(fd, chunk, std::min<std::size_t>(size - done, sizeof(chunk)), 0);
+
+    if (n <= 0) {
+      break;
+    }
+    data.insert(data.end(), chunk, chunk + n);
+    done += n;
+  }
+  return done;
+}
+
+// Read one line without newline, returns false if connection is closed
+// or the line is longer than SERVER_MAX_LINE
+static bool readLine(int fd, std::string &line, std::vector<char> &buffer)
+{
+  char data[4096];
+
+  while (true) {
+    const std::size_t length = std::min<std::size_t>(buffer.size(), SERVER_MAX_LINE + 1);
+    std::vector<char>::iterator end = std::find(buffer.begin(), buffer.begin() + length, '\n');
+
+    if (end != buffer.begin() + length) {
+      line.assign(buffer.begin(), end);
+      buffer.erase(buffer.begin(), end + 1);
+      return true;
+    }
+
+    if (buffer.size() > SERVER_MAX_LINE) {
+      return false;
+    }
+
+    ssize_t n = recv(fd, data, sizeof(data), 0);
+
+    if (n <= 0) {
+      return false;
+    }
+    buffer.insert(buffer.end(), data, data + n);
+  }
+}
+
+static bool writeLine(int fd, std::string line)
+{
+  line += '\n';
+
+  for (std::size_t done = 0; done < line.size(); ) {
+    ssize_t n = send(fd, line.data() + done, line.size() - done, MSG_NOSIGNAL);
+
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+static std::string probabilityLine(double probability)
+{
+  char line[32];
+  snprintf(line, sizeof(line), "%.8f", probability);
+  return std::string(line);
+}
+
+Server::Server(BayesClassifier &bayes, unsigned int threads)
+  : bayes(bayes), threads(threads)
+{
+  if (this->threads == 0) {
+    this->threads = ThreadPool::hardwareThreads();
+  }
+
+  // Workers only read the model
+  bayes.refresh();
+}
+
+bool Server::run(std::string socket_path)
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path " << socket_path << " is too long." << std::endl;
+    return false;
+  }
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  // Socket left by previous server is replaced, other files are kept
+  struct stat status;
+
+  if (lstat(socket_path.c_str(), &status) == 0) {
+    if (!S_ISSOCK(status.st_mode)) {
+      std::cerr << "File " << socket_path << " exists and is not a socket." << std::endl;
+      return false;
+    }
+    unlink(socket_path.c_str());
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    std::cerr << "Failed to listen on socket " << socket_path << "." << std::endl;
+    if (listener >= 0) {
+      close(listener);
+    }
+    return false;
+  }
+
+  // Start workers serving accepted connections
+  std::vector<std::thread> workers;
+
+  for (unsigned int i = 0; i < threads; i++) {
+    workers.push_back(std::thread(&Server::work, this));
+    workers.back().detach();
+  }
+
+  while (true) {
+    int connection = accept(listener, 0, 0);
+
+    if (connection < 0) {
+      // Wait for clients to close connections if resources are exhausted,
+      // aborted connections are skipped
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_ACCEPT_DELAY));
+      } else if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO) {
+        std::cerr << "Failed to accept connection on socket " << socket_path << "." << std::endl;
+        close(listener);
+        return false;
+      }
+      continue;
+    }
+
+    // recv() fails when client sends nothing until timeout
+    struct timeval timeout;
+    timeout.tv_sec = SERVER_IDLE_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::unique_lock<std::mutex> guard(lock);
+    connections.push_back(connection);
+    accepted.notify_one();
+  }
+
+  return true;
+}
+
+void Server::work()
+{
+  while (true) {
+    int connection;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+
+      while (connections.empty()) {
+        accepted.wait(guard);
+      }
+
+      connection = connections.front();
+      connections.pop_front();
+    }
+
+    serve(connection);
+    close(connection);
+  }
+}
+
+void Server::serve(int connection)
+{
+  std::vector<char> buffer;
+  std::string line;
+
+  while (readLine(connection, line, buffer)) {
+    if (!request(connection, line, buffer)) {
+      break;
+    }
+  }
+}
+
+bool Server::request(int connection, std::string line, std::vector<char> &buffer)
+{
+  std::istringstream input(line);
+  std::string command;
+  input >> command;
+
+  // Predict image stored in file
+  if (command.compare("PATH") == 0) {
+    std::string path = line.substr(std::min(line.size(), line.find("PATH") + 5));
+    MappedBitmap image(path);
+
+    if (!image) {
+      return writeLine(connection, "ERROR image " + path + " not found");
+    }
+    return writeLine(connection, probabilityLine(bayes.predict(image.view(), 0)));
+  }
+
+  // Predict image sent by client
+  if (command.compare("RAW") == 0) {
+    unsigned long width = 0, height = 0;
+    std::string order;
+    input >> width >> height >> order;
+
+    // Size is checked before multiplication, which could overflow
+    if (width == 0 || height == 0 || width > UINT_MAX / 3 || height > UINT_MAX ||
+        width > SERVER_MAX_PIXELS / height ||
+        (order.compare("BGR") != 0 && order.compare("RGB") != 0)) {
+      writeLine(connection, "ERROR invalid RAW request");
+      return false;
+    }
+
+    std::vector<char> pixels;
+    const std::size_t size = 3 * width * height;
+
+    try {
+      if (readBytes(connection, pixels, size, buffer) != size) {
+        return false;
+      }
+    }
+    catch (const std::bad_alloc &) {
+      // Rest of the pixels is not read, connection is closed
+      writeLine(connection, "ERROR out of memory");
+      return false;
+    }
+
+    ImageView image((const unsigned char *)&pixels[0], width, height, 3 * width,
+                    (order.compare("BGR") == 0) ? CHANNELS_BGR : CHANNELS_RGB);
+    return writeLine(connection, probabilityLine(bayes.predict(image, 0)));
+  }
+
+  if (command.compare("QUIT") == 0) {
+    return false;
+  }
+
+  return writeLine(connection, "ERROR unknown request " + command);
+}
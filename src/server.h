@@ -0,0 +1,79 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: server.h
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "bayesclassifier.h"
+
+// Largest image accepted in RAW request (number of pixels)
+#define SERVER_MAX_PIXELS (1UL << 24)
+
+// Pixels of RAW request are received in chunks of at most this size,
+// memory grows only with bytes the client actually sent (bytes)
+#define SERVER_READ_CHUNK (1UL << 16)
+
+// Longest request line (connection sending longer line is closed)
+#define SERVER_MAX_LINE 4096
+
+// Connection without any received data for this time is closed, so that
+// idle clients do not hold the worker threads (seconds)
+#define SERVER_IDLE_TIMEOUT 30
+
+// Delay before next accept() when the process is out of descriptors
+// or memory (milliseconds)
+#define SERVER_ACCEPT_DELAY 100
+
+// Prediction server listening on Unix domain socket. The model is
+// loaded or trained once and requests of connected clients are answered
+// concurrently by worker threads. Each request is one text line, the
+// response is a line with probability or with ERROR and reason.
+// Connections idle for SERVER_IDLE_TIMEOUT are closed.
+//  PATH image.bmp             - predict image stored in file
+//  RAW width height BGR|RGB   - predict image sent after the line as
+//                               width*height*3 bytes of pixels
+//  QUIT                       - close connection
+//
+class Server
+{
+public:
+  // Create server using trained model (0 threads - number of CPU cores)
+  Server(BayesClassifier &bayes, unsigned int threads = 0);
+
+  // Listen on socket and serve clients (returns only on failure)
+  bool run(std::string socket_path);
+
+protected:
+  // Wait for accepted connections and serve them
+  void work();
+
+  // Answer requests of one client until it disconnects
+  void serve(int connection);
+
+  // Answer one request line, returns false to close connection
+  bool request(int connection, std::string line, std::vector<char> &buffer);
+
+private:
+  BayesClassifier &bayes;
+  unsigned int threads;
+
+  std::mutex lock;
+  std::condition_variable accepted;
+  std::deque<int> connections;
+};
+
+#endif // SERVER_H
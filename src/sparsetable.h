@@ -0,0 +1,117 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: sparsetable.h
+ */
+
+#ifndef SPARSETABLE_H
+#define SPARSETABLE_H
+
+#include <vector>
+#include <cstddef>
+
+#include "nvector.h"
+
+// log2 of number of elements in block of sparse table
+#define SPARSE_BLOCK_BITS 12
+
+// Tables (histograms or posterior) of RGB models with more memory
+// in dense form are stored as sparse tables
+#define SPARSE_TABLE_MEMORY (4UL << 20)
+
+// Block-sparse table of size elements. Elements are stored by blocks
+// of 2^SPARSE_BLOCK_BITS elements, a block is allocated by first write
+// into it. Block index holds offset of each block in data, blocks which
+// were never written share the zero block at offset 0, so any element
+// is read by two loads without branches (element n is at
+// data[index[n >> SPARSE_BLOCK_BITS] + (n & SPARSE_BLOCK_MASK)]).
+//
+template <typename T>
+class SparseTable {
+public:
+  static const std::size_t BLOCK = (std::size_t)1 << SPARSE_BLOCK_BITS;
+  static const std::size_t MASK  = BLOCK - 1;
+
+  SparseTable(std::size_t size = 0) :
+    length(size), index((size + MASK) >> SPARSE_BLOCK_BITS, 0), data(BLOCK, T()) {}
+
+  // Read element (zero if its block is not allocated)
+  T const & operator[](std::size_t n) const {
+    return get(n);
+  }
+
+  T const & get(std::size_t n) const {
+    return data[index[n >> SPARSE_BLOCK_BITS] + (n & MASK)];
+  }
+
+  // Get element for writing, its block is allocated if needed
+  // (read elements of non-const table by get())
+  T & operator[](std::size_t n) {
+    return block(n >> SPARSE_BLOCK_BITS)[n & MASK];
+  }
+
+  // Get block for writing, allocate it if needed
+  T * block(std::size_t b) {
+    if (index[b] == 0) {
+      index[b] = data.size();
+      data.resize(data.size() + BLOCK, T());
+    }
+    return &data[index[b]];
+  }
+
+  // Get block for reading (zero block if not allocated)
+  const T * block(std::size_t b) const {
+    return &data[index[b]];
+  }
+
+  bool allocated(std::size_t b) const { return index[b] != 0; }
+
+  // Reserve memory for given number of allocated blocks
+  void reserve(std::size_t count) {
+    data.reserve((count + 1) * BLOCK);
+  }
+
+  // Get sum of elements
+  double sum() const {
+    double s = 0;
+
+    for (std::size_t i = BLOCK; i < data.size(); i++) {
+      s += data[i];
+    }
+    return s;
+  }
+
+  std::size_t size() const { return length; }
+  std::size_t blocks() const { return index.size(); }
+
+  // Get number of stored elements (allocated blocks and zero block)
+  std::size_t stored() const { return data.size(); }
+
+  // Get block index and storage of blocks (for kernels)
+  const unsigned int * indexPtr() const { return index.empty() ? 0 : &index[0]; }
+  const T * dataPtr() const { return &data[0]; }
+
+  // Get number of bytes used by table
+  std::size_t memory() const {
+    return index.size() * sizeof(unsigned int) + data.size() * sizeof(T);
+  }
+
+private:
+  std::size_t length;
+  std::vector<unsigned int> index;
+  std::vector<T, aligned_allocator<T> > data;
+};
+
+// Definitions of constants (needed when they are bound to references,
+// eg by std::min)
+template <typename T>
+const std::size_t SparseTable<T>::BLOCK;
+
+template <typename T>
+const std::size_t SparseTable<T>::MASK;
+
+#endif // SPARSETABLE_H
@@ -0,0 +1,107 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: threadpool.cpp
+ */
+
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+  job = 0;
+  next_task = 0;
+  tasks = 0;
+  finished_tasks = 0;
+  stop = false;
+
+  if (threads == 0) {
+    threads = hardwareThreads();
+  }
+
+  for (unsigned int i = 0; i < threads; i++) {
+    workers.push_back(std::thread(&ThreadPool::work, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    stop = true;
+  }
+  job_ready.notify_all();
+
+  for (unsigned int i = 0; i < workers.size(); i++) {
+    workers.at(i).join();
+  }
+}
+
+void ThreadPool::run(unsigned int count, const task_t &task)
+{
+  if (count == 0) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> guard(lock);
+
+  // Jobs submitted from several threads are run one after another
+  while (job != 0) {
+    job_done.wait(guard);
+  }
+
+  job = &task;
+  next_task = 0;
+  tasks = count;
+  finished_tasks = 0;
+
+  job_ready.notify_all();
+
+  while (finished_tasks < tasks) {
+    job_done.wait(guard);
+  }
+
+  job = 0;
+  job_done.notify_all();
+}
+
+unsigned int ThreadPool::size()
+{
+  return workers.size();
+}
+
+unsigned int ThreadPool::hardwareThreads()
+{
+  unsigned int threads = std::thread::hardware_concurrency();
+  return (threads > 0) ? threads : 1;
+}
+
+void ThreadPool::work(unsigned int worker)
+{
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (true) {
+    while (!stop && (job == 0 || next_task >= tasks)) {
+      job_ready.wait(guard);
+    }
+
+    if (stop) {
+      return;
+    }
+
+    // Take next task of current job and run it without holding lock
+    const task_t *task = job;
+    unsigned int index = next_task++;
+
+    guard.unlock();
+    (*task)(index, worker);
+    guard.lock();
+
+    if (++finished_tasks == tasks) {
+      job_done.notify_all();
+    }
+  }
+}
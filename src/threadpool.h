@@ -0,0 +1,61 @@
+/**
+ *
+ *  Binary classification using Bayesian classifier
+ *  by Jakub Vojvoda, github.com/JakubVojvoda
+ *  2016
+ *
+ *  GNU LGPL v3 (see LICENSE)
+ *  file: threadpool.h
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads executing indexed tasks. Each task
+// gets its index and index of worker running it, so workers can
+// use private data (eg histograms) without synchronization.
+//
+class ThreadPool
+{
+public:
+  typedef std::function<void(unsigned int task, unsigned int worker)> task_t;
+
+  // Create pool with given number of workers (0 - number of CPU cores)
+  ThreadPool(unsigned int threads = 0);
+  ~ThreadPool();
+
+  // Run task for indices 0 .. tasks-1 and wait until all are finished
+  void run(unsigned int tasks, const task_t &task);
+
+  // Get number of worker threads
+  unsigned int size();
+
+  // Get number of CPU cores (at least 1)
+  static unsigned int hardwareThreads();
+
+protected:
+  // Execute tasks of submitted jobs
+  void work(unsigned int worker);
+
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex lock;
+  std::condition_variable job_ready;
+  std::condition_variable job_done;
+
+  const task_t *job;
+  unsigned int next_task;
+  unsigned int tasks;
+  unsigned int finished_tasks;
+
+  bool stop;
+};
+
+#endif // THREADPOOL_H